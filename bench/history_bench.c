@@ -0,0 +1,89 @@
+/*
+ * History benchmark: records 1M commands (300k distinct texts, so most are
+ * repeats moved to the newest slot) into a 100k-entry history, each run
+ * journaled as the shell does. Then lists the history as log does (the
+ * first access replays the whole journal) and, after the exit compaction,
+ * starts a new session on it.
+ *
+ *   make bench/history_bench && bench/history_bench [records] [distinct] [size]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    unsigned long records = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    unsigned long distinct = argc > 2 ? strtoul(argv[2], NULL, 10) : 300000;
+    const char *size = argc > 3 ? argv[3] : "100000";
+    if (records == 0 || distinct == 0) {
+        fprintf(stderr, "usage: %s [records] [distinct] [size]\n", argv[0]);
+        return 2;
+    }
+
+    /* the journal goes to a scratch $HOME */
+    char home[] = "/tmp/osh-histbench-XXXXXX";
+    if (!mkdtemp(home)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("HOME", home, 1);
+    setenv("OSH_HISTSIZE", size, 1);
+    if (history_init() != 0) {
+        fprintf(stderr, "history_init failed\n");
+        return 1;
+    }
+
+    char line[64];
+    unsigned long x = 88172645463325252ul;
+    double t0 = now();
+    for (unsigned long i = 0; i < records; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        snprintf(line, sizeof(line), "make -C build/target%lu all", x % distinct);
+        if (history_add(line) < 0) {
+            fprintf(stderr, "history_add failed\n");
+            return 1;
+        }
+        history_finish(0);
+    }
+    double t1 = now();
+    size_t n = history_count();
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t len;
+        if (history_get(i, &len)) total += len;
+    }
+    double t2 = now();
+    history_cleanup();
+
+    /* a new session: startup, then the first access replays the journal */
+    double t3 = now();
+    history_init();
+    double t4 = now();
+    size_t n2 = history_count();
+    double t5 = now();
+    history_cleanup();
+
+    printf("record %lu commands (%lu distinct, history of %s): %.3fs, %.2f us each\n",
+           records, distinct, size, t1 - t0, (t1 - t0) / (double)records * 1e6);
+    printf("first log: replay the journal, list %zu entries (%zu bytes): %.3fs\n", n, total,
+           t2 - t1);
+    printf("new session after compaction: startup %.3f ms, first log (%zu entries) %.3fs\n",
+           (t4 - t3) * 1e3, n2, t5 - t4);
+
+    char cmd[sizeof(home) + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", home);
+    return system(cmd) == 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Pipeline launch latency of the shell.
+
+Types L lines (default 200), each a pipeline of 1, 4 or 16 'true' stages,
+into the shell on a pseudo-terminal and prints the time per pipeline,
+prompt round trip included. Compare launch engines by pointing SHELL_BIN at another
+build, e.g. one checked out from before posix_spawn was introduced.
+
+    python3 bench/spawn_bench.py [L]        (run from the repo root)
+"""
+import os
+import pty
+import re
+import select
+import sys
+import tempfile
+import time
+
+# the prompt ends in "> ", possibly followed by terminal mode sequences
+PROMPT_END = re.compile(rb"> (\x1b\[[0-9;?]*[A-Za-z])*$")
+
+
+def wait_prompt(fd):
+    out = b""
+    while not PROMPT_END.search(out):
+        r, _, _ = select.select([fd], [], [], 10)
+        if not r:
+            raise SystemExit("spawn_bench: shell stopped responding")
+        chunk = os.read(fd, 65536)
+        if not chunk:
+            raise SystemExit("spawn_bench: shell exited")
+        out = (out + chunk)[-256:]
+
+
+def run(shell, line, count):
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.execv(shell, [shell])
+    wait_prompt(fd)
+    # one line at a time, each after the prompt, as typed: older builds
+    # drop input that arrives ahead of the prompt
+    t0 = time.monotonic()
+    for _ in range(count):
+        os.write(fd, line + b"\n")
+        wait_prompt(fd)
+    elapsed = time.monotonic() - t0
+    os.write(fd, b"\x04")
+    os.waitpid(pid, 0)
+    os.close(fd)
+    return elapsed
+
+
+def main():
+    nlines = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    shell = os.path.abspath(os.environ.get("SHELL_BIN", "shell.out"))
+    if not os.access(shell, os.X_OK):
+        raise SystemExit("spawn_bench: build %s first" % shell)
+    # the shell keeps its history where it starts
+    os.chdir(tempfile.mkdtemp())
+    for stages in (1, 4, 16):
+        line = b" | ".join([b"true"] * stages)
+        t = run(shell, line, nlines)
+        print("%2d stages: %d lines in %.3fs, %.0f us per pipeline"
+              % (stages, nlines, t, t / nlines * 1e6))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,54 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump-pointer arena for per-line allocations (tokens, argv arrays,
+ * redirection targets and pipeline nodes). Memory is never freed piecemeal:
+ * arena_reset() rewinds the arena between prompts and keeps its chunks, so
+ * a long session stops calling malloc once the largest line has been seen.
+ *
+ * A zero-initialized Arena is valid and empty.
+ *
+ * Build with -DARENA_DEBUG to print usage and high-water marks to stderr on
+ * every reset.
+ */
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+    ArenaChunk *first;   /* chunk list, kept across resets */
+    ArenaChunk *cur;     /* chunk currently allocated from */
+    size_t used;         /* bytes handed out since the last reset */
+    size_t high_water;   /* largest 'used' ever observed */
+    size_t nchunks;
+} Arena;
+
+/* Position to return to with arena_rewind() */
+typedef struct {
+    ArenaChunk *chunk;
+    size_t off;
+    size_t used;
+} ArenaMark;
+
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t size);
+/* Grow ptr (the size of which was old_size) to new_size. Extends in place
+ * when ptr is the most recent allocation, copies otherwise. */
+void *arena_realloc(Arena *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strndup(Arena *a, const char *s, size_t n);
+char *arena_strdup(Arena *a, const char *s);
+
+ArenaMark arena_mark(const Arena *a);
+void arena_rewind(Arena *a, ArenaMark m);
+
+/* Make all memory available again without returning it to the system */
+void arena_reset(Arena *a);
+/* Release all chunks */
+void arena_destroy(Arena *a);
+
+/* The shell's arena for the line currently being executed */
+Arena *line_arena(void);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef DAGRUN_H
+#define DAGRUN_H
+
+#include <stddef.h>
+
+/*
+ * shell.out --parallel [-j N] file
+ *
+ * Runs the command lines of 'file' concurrently, at most N at a time
+ * (default: the number of online CPUs), as background jobs of the shell.
+ * Lines are ordered only where they have to be:
+ *   - a line that reads or writes a file (through '<', '>' or '>>') waits
+ *     for every earlier line that writes it, and a line that writes a file
+ *     also waits for the earlier lines that read it;
+ *   - a line using a builtin that changes shell state (hop, log, fg, bg,
+ *     hash, queue) waits for all earlier lines, runs in the shell itself,
+ *     and all later lines wait for it.
+ * Paths are compared after making them absolute against the cwd in effect
+ * and removing '.' and '..' (symlinks are not resolved). Files named only
+ * as arguments are invisible to the analysis.
+ *
+ * Blank lines and lines starting with '#' are skipped. Every line is
+ * parsed before anything runs; on a syntax error nothing runs. Commands
+ * get /dev/null as stdin, and their output is not reordered.
+ *
+ * Returns the number of failed lines (capped at 100), 130 if interrupted,
+ * 127 if the file cannot be read and 255 on a syntax error.
+ */
+int dagrun_file(const char *path, size_t nslots);
+
+#endif
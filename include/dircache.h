@@ -0,0 +1,34 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include "reveal.h"
+
+/*
+ * Sorted directory listings kept between reveal calls, keyed by the
+ * directory's (st_dev, st_ino) and evicted least recently used first.
+ *
+ * An entry is dropped when an inotify watch on its directory reports a
+ * name being created, deleted or moved, or when the directory's mtime no
+ * longer matches the one it was read under. Without a watch (no inotify,
+ * or out of watches) the mtime alone decides; a directory modified within
+ * the last couple of seconds is then not cached, since a change in the
+ * same timestamp tick would go unnoticed.
+ */
+
+/*
+ * Listing of the open directory 'fd' (whose path is 'path', for display
+ * and for the watch), from the cache or read now. Returns a listing owned
+ * by the cache, valid until the next dircache call, or NULL with errno set.
+ */
+const DirListing *dircache_listing(int fd, const char *path);
+
+/* Print the cached directories plus entry count, memory and hit rate. */
+void dircache_print(void);
+
+/* Drop every entry (watches included). */
+void dircache_clear(void);
+
+/* Free all cache memory and close the inotify fd. */
+void dircache_cleanup(void);
+
+#endif
@@ -3,26 +3,40 @@
 
 #include <sys/types.h>
 
-int exec_run_line(const char *line);
-// Background job structure
-typedef struct bg_job {
-    pid_t pid;
-    int job_id;
-    char *command;
-    int stopped; /* 1 if stopped, 0 if running */
-    struct bg_job *next;
-} bg_job;
-
-extern bg_job *job_list;
+#include "parser.h"
+#include "jobs.h"
 
+int exec_run_line(const char *line);
+int exec_run_parsed(const CmdLine *cl);
+/* Exit status of the last foreground command group run (128+N if killed
+ * by signal N, 127 if it could not be started) */
+int exec_last_status(void);
+/* Start cmds[0..ncmds) as one pipeline in process group 'pgid' (0 = new
+ * group). in_fd/out_fd replace the first stage's stdin and the last stage's
+ * stdout (-1 = inherit). pids[i] gets each stage's pid, -1 if it failed to
+ * start. Returns the process group id, or -1 if nothing started.
+ */
+pid_t launch_pipeline(const CmdNode *cmds, size_t ncmds, int in_fd, int out_fd,
+                      pid_t pgid, pid_t *pids);
+/* Start a line in the background without the "[id] pid" notice: one
+ * command group as its pipeline, several in a forked copy of the shell.
+ * Returns its job, or NULL if it could not be parsed or started.
+ */
+bg_job *exec_start_job(const char *line);
 /* Function declarations */
-void execute_command(char *command);
 void init_job_list(void);
-void add_background_job(pid_t pid, const char *cmd);
-void add_stopped_job(pid_t pid, const char *cmd);
-void check_background_jobs(void);
-void execute_sequential_commands(char **commands, int count);
-void execute_background_command(char *command);
+void add_stopped_job(pid_t pgid, const pid_t *pids, const CmdNode *cmds, size_t n,
+                     const char *cmd);
+/* Reap every pending child state change (waitpid(-1) loop) */
+void reap_children(void);
+/* Reap, then print queued completion notices; returns how many printed */
+int check_background_jobs(void);
+/* Readable whenever a child changes state (SIGCHLD self-pipe), or -1 */
+int exec_sigchld_fd(void);
+
+/* Non-interactive mode (scripts, -c): the foreground wait leaves stdin
+ * alone, and exit neither prints "logout" nor kills background jobs */
+void exec_set_interactive(int on);
 
 /* Ctrl-D helpers */
 void kill_all_children(void);
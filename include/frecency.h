@@ -0,0 +1,49 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <stddef.h>
+
+/*
+ * Frecency database of the directories hop has visited, for keyword jumps.
+ *
+ * ~/.osh_dirs is a compact file that is only ever mmap'd: a header, an
+ * array of fixed-size records (visit rank, last visit time, offsets), an
+ * open-addressing table from path hash to record, a trigram index, the
+ * paths themselves, and a pool of the lowercased last path components
+ * separated by NULs.
+ *
+ * Visits are not written into it. Each one is a line appended with one
+ * O_APPEND write() to ~/.osh_dirs.log, "<time> <path>\n", which every
+ * session reads incrementally and folds into an in-memory overlay. Once
+ * the log passes 256 KB it is merged into a new ~/.osh_dirs, written to a
+ * temporary file and renamed into place, and the log is replaced by an
+ * empty one. Sessions coordinate through flock() on ~/.osh_dirs.lock, like
+ * the history journal.
+ *
+ * Records are stored highest rank first, and a trigram index maps each
+ * three bytes of a lowercased last component to the records holding them,
+ * so a keyword of three or more bytes walks one short posting list and
+ * stops as soon as no later record could rank among the best. Shorter
+ * keywords take one memmem() pass over the pool of last components.
+ *
+ * Ranking follows zoxide: rank (visits, aged by 0.9 whenever the total
+ * passes FRECENCY_RANK_MAX, dropping entries under 1) times 4 if the last
+ * visit was within an hour, 2 within a day, 1/2 within a week, 1/4 older.
+ * Directories a lookup finds gone are skipped and dropped at the next merge.
+ */
+
+/* Record a visit to the absolute directory 'path'. */
+void frecency_visit(const char *path);
+
+/*
+ * Best directory whose last component contains 'keyword' (ignoring case
+ * when the keyword is all lowercase), skipping 'cwd' and directories that
+ * no longer exist. Copies it into out[0..outsz) and returns 0, or returns
+ * -1 if nothing matches.
+ */
+int frecency_lookup(const char *keyword, const char *cwd, char *out, size_t outsz);
+
+/* Free everything (the log already holds this session's visits). */
+void frecency_cleanup(void);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+/* What is known about the runs of one history entry */
+typedef struct {
+    long long start;        /* latest run: start time (seconds since the epoch) */
+    long long duration_us;  /* latest run: wall time, -1 if unknown */
+    int status;             /* latest run: exit status (128+N for signal N), -1 if unknown */
+    const char *cwd;        /* latest run: working directory, not NUL-terminated */
+    size_t cwd_len;
+    size_t runs;            /* runs recorded with metadata */
+    size_t failures;        /* runs with a nonzero status */
+    long long total_us;     /* wall time of all runs */
+} HistMeta;
+
+/*
+ * Command history backed by an append-only journal in ~/.osh_history.
+ *
+ * Every run of a recorded command is one record added with a single
+ * O_APPEND write() once it finishes: "\x1f<tags>\x1f<command>\n", where the
+ * tags hold its start time, duration, exit status and working directory.
+ * Plain "<command>\n" records (from older versions) are read as well.
+ * Loading replays the journal through the same rules as recording (unique
+ * entries, newest last, at most history_get_max() kept), and a record
+ * without its trailing newline (torn by a crash) is ignored.
+ * The journal is compacted to the live entries by writing a temporary file
+ * and renaming it over the old one, so the file is never truncated in place.
+ *
+ * Sessions share the journal. Appends and compactions are coordinated with
+ * flock() on ~/.osh_history.lock, and a loaded session merges the records
+ * other sessions appended by reading on from the offset it last reached.
+ *
+ * Startup only mmaps the journal and reads its last record; the entries
+ * are indexed on first access (history_count/history_get/history_set_max)
+ * and point into the mapping rather than being copied.
+ */
+
+/* Map the journal and open it for appending. Returns 0 on success, -1 on error. */
+int history_init(void);
+
+/* Compact the journal if it holds stale records, then free everything. */
+void history_cleanup(void);
+
+/* Record 'line' as the newest entry (moving an existing copy) and start
+ * timing the run. Returns 1 if recorded, 0 if it already is the newest
+ * entry, -1 on error. */
+int history_add(const char *line);
+
+/* Finish the run started by history_add(): its record is written to the
+ * journal with the start time, duration, 'status' and working directory.
+ * Does nothing if no run is pending. */
+void history_finish(int status);
+
+/* Number of entries after merging other sessions' records, and entry i
+ * counted from the oldest (0) as of that merge. The text is
+ * not NUL-terminated (it may point into the mapped journal); its length is
+ * stored in *len. It stays valid until the next history call. */
+size_t history_count(void);
+const char *history_get(size_t i, size_t *len);
+
+/* Run metadata of entry i, or NULL if none was recorded */
+const HistMeta *history_get_meta(size_t i);
+
+/* Find entries containing q[0..qlen), newest first. Stores up to 'max'
+ * of their history_get() indexes in 'out' and returns how many. Queries of
+ * 3 or more bytes go through a trigram index built on the first search. */
+size_t history_search(const char *q, size_t qlen, size_t *out, size_t max);
+
+/* The newest entry containing q[0..qlen) older than entry 'before' (pass
+ * history_count() to start at the newest). Stores its history_get() index
+ * in *out and returns 1, or returns 0 if there is none. Allocates nothing,
+ * so stepping back one match at a time costs one search per step. */
+int history_search_older(const char *q, size_t qlen, size_t before, size_t *out);
+
+/* Forget all entries and empty the journal. */
+void history_purge(void);
+
+/* Number of entries kept (HIST_MAX, or $OSH_HISTSIZE at startup). Lowering
+ * it evicts the oldest entries and compacts the journal. */
+size_t history_get_max(void);
+void history_set_max(size_t max);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+/*
+ * Shell-owned buffer for bytes read from stdin. The line reader takes its
+ * input from here in bulk instead of one read() per keystroke, and bytes
+ * read beyond the end of a line stay buffered for the next one. The
+ * foreground wait appends what is typed while a job runs, so typeahead
+ * reaches the next prompt instead of being lost.
+ *
+ * The buffer is a power-of-two ring that grows as needed.
+ */
+
+/* Read whatever stdin has available (blocking until something arrives).
+ * Returns the number of bytes added, 0 on EOF, -1 on error. */
+long input_fill(void);
+
+/* Like input_fill(), but give up after timeout_ms if nothing arrives.
+ * Returns the number of bytes added, 0 on EOF or timeout, -1 on error. */
+long input_fill_timeout(int timeout_ms);
+
+/* Number of buffered bytes */
+size_t input_pending(void);
+
+/* Oldest buffered bytes as one contiguous span; returns its length */
+size_t input_peek(const char **p);
+
+/* Copy up to n buffered bytes (across the wrap) without consuming them */
+size_t input_copy(char *dst, size_t n);
+
+/* Whether byte c is among the n newest buffered bytes */
+int input_tail_contains(size_t n, char c);
+
+/* Drop the n oldest buffered bytes */
+void input_consume(size_t n);
+
+/* Next byte, reading stdin if the buffer is empty; -1 on EOF or error */
+int input_getc(void);
+
+/* Free the buffer. */
+void input_cleanup(void);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 
+#include "parser.h"
+
 /*
  * Initialize intrinsics subsystem (loads persistent history).
  * Returns 0 on success, -1 on error.
@@ -17,7 +19,8 @@ void intrinsics_cleanup(void);
 /*
  * Record a user-entered shell_cmd into history if it should be recorded
  * according to the rules (max 15, no consecutive duplicates, never store
- * commands containing an atomic 'log' name).
+ * commands containing an atomic 'log' name). 'cl' is the parsed form of
+ * 'line' and is used to find the atomic names.
  *
  * This function is intended to be called once per user-entered command
  * (after syntax validation). If you are re-executing a command returned
@@ -25,13 +28,16 @@ void intrinsics_cleanup(void);
  *
  * Returns 1 if added, 0 if skipped (not added), -1 on error.
  */
-int intrinsics_record_command(const char *line);
+int intrinsics_record_command(const char *line, const CmdLine *cl);
 
 /*
  * Try to handle a command if it is an intrinsic (hop/reveal/log).
+ * hop/reveal/log are handled here when the line is a single foreground
+ * atomic without redirections; "log execute <n>" is always handled here so
+ * the rest of the line can be appended to the stored command.
  *
  * Parameters:
- *   line           - the original user-entered line (nul-terminated)
+ *   cl             - the parsed user-entered line
  *   out_reexec_cmd - if intrinsics_handle returns 2, *out_reexec_cmd will
  *                    be set to a malloc'd string containing the stored
  *                    command to re-execute (caller must free). Otherwise
@@ -43,8 +49,10 @@ int intrinsics_record_command(const char *line);
  *   2 => intrinsic handled and requested re-execution; out_reexec_cmd set
  *  -1 => intrinsic handled but an error occurred (message already printed)
  */
-int intrinsics_handle(const char *line, char **out_reexec_cmd);
+int intrinsics_handle(const CmdLine *cl, char **out_reexec_cmd);
 
+/* Run one intrinsic on its arguments; the return values are those of
+ * intrinsics_handle, -1 whenever an error was printed. */
 int handle_hop_args(char **args, size_t nargs);
 int handle_reveal_args(char **args, size_t nargs);
 int handle_log_args(char **args, size_t nargs, char **out_reexec_cmd);
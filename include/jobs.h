@@ -0,0 +1,82 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Job table: every background or stopped pipeline known to the shell.
+ *
+ * Besides the most-recent-first list, the table keeps three indexes that
+ * are updated incrementally as jobs come and go, so no operation has to
+ * walk all jobs:
+ *   - job id      -> job            (hash map)
+ *   - stage pid   -> (job, stage)   (hash map, every live stage)
+ *   - (name, pid) -> stage          (treap, the order 'activities' prints)
+ */
+
+struct bg_job;
+
+/* One process of a background pipeline */
+typedef struct bg_stage {
+    pid_t pid;     /* -1 once reaped */
+    int stopped;
+    char *name;    /* stage text shown by 'activities' */
+    struct bg_job *job;
+    struct bg_stage *left, *right;  /* activities order */
+    unsigned prio;
+} bg_stage;
+
+// Background job structure
+typedef struct bg_job {
+    pid_t pid;     /* process group id (pid of the first stage) */
+    bg_stage *stages;
+    size_t nstages;
+    size_t nlive;  /* stages not yet reaped */
+    int status;    /* wait status of the last stage */
+    int job_id;
+    char *command;
+    int stopped; /* 1 if any stage is stopped, 0 if running */
+    void *owner; /* whoever started the job (a queue entry...), or NULL */
+    /* called with owner and the wait status once the job is gone */
+    void (*on_done)(void *owner, int status);
+    int quiet;   /* no completion notice */
+    struct bg_job *prev, *next;
+} bg_job;
+
+/* Most recent job first */
+extern bg_job *job_list;
+
+/*
+ * Allocate a job for process group 'pgid' made of the stages pids[0..n)
+ * (entries <= 0 never started and count as reaped). names[i] is copied as
+ * the text of stage i. The job is not in the table yet.
+ */
+bg_job *jobs_new(pid_t pgid, const pid_t *pids, char *const *names, size_t n,
+                 const char *cmd, int stopped);
+
+/* Give 'job' the next job id and index it with all of its live stages.
+ * Returns 0, or -1 if the indexes could not grow; the job is then not in
+ * the table. */
+int jobs_add(bg_job *job);
+
+/* Take 'job' out of the table (it keeps its stages); the caller owns it. */
+void jobs_remove(bg_job *job);
+
+/* Free a job that is not in the table. */
+void jobs_free(bg_job *job);
+
+/* Lookups; NULL if unknown. jobs_find_pid stores the stage index. */
+bg_job *jobs_find(int job_id);
+bg_job *jobs_find_pid(pid_t pid, size_t *stage);
+
+/* Stage 'i' of an indexed job has been reaped: drop it from the indexes. */
+void jobs_stage_done(bg_job *job, size_t i);
+
+/* Call fn for every live stage, ordered by name (then pid). */
+void jobs_foreach_stage(void (*fn)(const bg_stage *st, void *arg), void *arg);
+
+/* Free every job in the table and reset job ids. */
+void jobs_clear(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+/*
+ * parallel [-j N] [-k] [-a file] command [args...] [::: input...]
+ *
+ * Runs 'command' once per input (a line of the -a file or of stdin, or
+ * each word after ':::'), keeping at most N jobs in flight (default: the
+ * number of online CPUs). '{}' in the arguments is replaced by the input;
+ * without '{}' the input is appended as the last argument. With -k each
+ * job's output is buffered and emitted in input order.
+ *
+ * Runs as a forked pipeline stage: jobs join its process group, so Ctrl-C,
+ * Ctrl-Z, fg and bg act on the whole run. Returns the number of failed
+ * jobs (capped at 100), or 255 on a usage error.
+ */
+int builtin_parallel(char **argv, size_t argc);
+
+#endif
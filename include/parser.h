@@ -2,7 +2,55 @@
 #define PARSER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
+#include "arena.h"
+
+/*
+ * Command AST produced by a single pass over the input line:
+ *
+ *   CmdLine  (<line>)          groups separated by ';'
+ *   CmdGroup (<command_group>) atomics joined by '|', optional trailing '&'
+ *   CmdNode  (<atomic>)        argv plus '<', '>' and '>>' redirections
+ *
+ * The same tree is used for syntax validation, builtin dispatch and
+ * execution, so a line is only ever tokenized once. All nodes, strings and
+ * arrays live in the Arena passed to the parser and go away with it.
+ */
+
+/* A command node for a single stage in a pipeline */
+typedef struct {
+    char **argv;     /* NULL-terminated argv */
+    size_t argc;
+    char *infile;    /* or NULL */
+    char *outfile;   /* or NULL */
+    int append;      /* 1 for >>, 0 for > */
+    size_t src_end;  /* offset in CmdLine.src just past this atomic */
+} CmdNode;
+
+/* A pipeline of one or more atomics */
+typedef struct {
+    CmdNode *cmds;
+    size_t ncmds;
+    int background;  /* 1 if terminated by '&' */
+    char *text;      /* tokens joined by single spaces, without '&' */
+} CmdGroup;
+
+/* A whole input line */
+typedef struct {
+    CmdGroup *groups;
+    size_t ngroups;
+    char *src;       /* copy of the parsed line */
+} CmdLine;
+
+/*
+ * Parse a line according to the shell grammar into 'arena'.
+ * Returns the tree, or NULL if the line is not valid syntax (or on
+ * allocation failure); in that case nothing stays allocated in the arena.
+ */
+CmdLine *parse_command_line(Arena *arena, const char *line);
+
+/* Returns true if the line matches the grammar. */
 bool validate_syntax(const char *line);
 
-#endif 
+#endif
@@ -0,0 +1,35 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+/*
+ * Command name -> absolute path cache for $PATH lookups.
+ *
+ * Entries stay valid while $PATH is unchanged and none of its directories'
+ * mtimes moved; pathcache_validate() checks that (one stat per PATH
+ * directory) and flushes the table otherwise.
+ */
+
+/* Re-check $PATH and directory mtimes; flush the table if anything changed. */
+void pathcache_validate(void);
+
+/*
+ * Resolve 'name' (which must not contain '/') to an executable path.
+ * Returns a string owned by the cache (valid until the next pathcache call),
+ * or NULL if no PATH directory holds an executable of that name.
+ */
+const char *pathcache_lookup(const char *name);
+
+/* Look 'name' up and remember it without counting a hit (hash <name>).
+ * Returns 0 if found, -1 otherwise. */
+int pathcache_add(const char *name);
+
+/* Forget every cached entry. */
+void pathcache_clear(void);
+
+/* Print the entries with their hit counts plus the global hit/miss counters. */
+void pathcache_print(void);
+
+/* Free all cache memory. */
+void pathcache_cleanup(void);
+
+#endif
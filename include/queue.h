@@ -0,0 +1,33 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * Batch queue: command lines added with 'queue add' wait in FIFO order and
+ * are started as background jobs whenever a slot is free (and, if a load
+ * limit is set, while the 1-minute load average stays below it). Started
+ * entries are ordinary jobs, so activities, fg, bg and ping work on them.
+ */
+
+/* The calling process owns the queue; call once at shell startup. */
+void queue_init(void);
+
+/* queue [status] | add <cmd...> | limit [N] | load [X] | clear.
+ * Returns 0, or 1 after printing an error. */
+int builtin_queue(char **argv, size_t argc);
+
+/* Start pending entries while slots are free. Called at safe points. */
+void queue_schedule(void);
+
+/* The job started for 'entry' finished with wait status 'status'. */
+void queue_job_done(void *entry, int status);
+
+/* Poll timeout (ms) the shell should use while idle: entries held back only
+ * by the load limit need a periodic re-check. -1 means block. */
+int queue_poll_timeout(void);
+
+/* Free all entries. */
+void queue_cleanup(void);
+
+#endif
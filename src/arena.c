@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_SIZE 4096
+
+struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;   /* usable bytes in data[] */
+    size_t off;    /* next free byte in data[] */
+    char *last;    /* most recent allocation, for in-place growth */
+    char *data;
+};
+
+static Arena g_line_arena;
+
+Arena *line_arena(void) {
+    return &g_line_arena;
+}
+
+static size_t align_up(size_t n) {
+    return (n + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static ArenaChunk *chunk_new(size_t min_size) {
+    size_t size = ARENA_CHUNK_SIZE;
+    while (size < min_size) size *= 2;
+    size_t hdr = align_up(sizeof(ArenaChunk));
+    ArenaChunk *c = malloc(hdr + size);
+    if (!c) return NULL;
+    c->next = NULL;
+    c->size = size;
+    c->off = 0;
+    c->last = NULL;
+    c->data = (char *)c + hdr;
+    return c;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+    size = align_up(size ? size : 1);
+    ArenaChunk *c = a->cur;
+    /* move on to the next retained chunk that fits, or append a new one */
+    while (!c || c->off + size > c->size) {
+        ArenaChunk *next = c ? c->next : a->first;
+        if (!next) {
+            next = chunk_new(size);
+            if (!next) return NULL;
+            if (c) c->next = next; else a->first = next;
+            a->nchunks++;
+        } else {
+            next->off = 0;
+            next->last = NULL;
+        }
+        c = next;
+        a->cur = c;
+    }
+    char *p = c->data + c->off;
+    c->off += size;
+    c->last = p;
+    a->used += size;
+    if (a->used > a->high_water) a->high_water = a->used;
+    return p;
+}
+
+void *arena_calloc(Arena *a, size_t size) {
+    void *p = arena_alloc(a, size);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+void *arena_realloc(Arena *a, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_alloc(a, new_size);
+    if (new_size <= old_size) return ptr;
+    ArenaChunk *c = a->cur;
+    if (c && c->last == ptr) {
+        size_t start = (size_t)((char *)ptr - c->data);
+        size_t need = align_up(new_size);
+        if (start + need <= c->size) {
+            a->used += need - (c->off - start);
+            c->off = start + need;
+            if (a->used > a->high_water) a->high_water = a->used;
+            return ptr;
+        }
+    }
+    void *np = arena_alloc(a, new_size);
+    if (!np) return NULL;
+    memcpy(np, ptr, old_size);
+    return np;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    if (!p) return NULL;
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+ArenaMark arena_mark(const Arena *a) {
+    ArenaMark m;
+    m.chunk = a->cur;
+    m.off = a->cur ? a->cur->off : 0;
+    m.used = a->used;
+    return m;
+}
+
+void arena_rewind(Arena *a, ArenaMark m) {
+    if (!m.chunk) {
+        arena_reset(a);
+        return;
+    }
+    a->cur = m.chunk;
+    a->cur->off = m.off;
+    a->cur->last = NULL;
+    a->used = m.used;
+}
+
+void arena_reset(Arena *a) {
+#ifdef ARENA_DEBUG
+    if (a->used) {
+        fprintf(stderr, "[arena] line used %zu bytes, high-water %zu bytes in %zu chunk(s)\n",
+                a->used, a->high_water, a->nchunks);
+    }
+#endif
+    a->cur = a->first;
+    if (a->cur) {
+        a->cur->off = 0;
+        a->cur->last = NULL;
+    }
+    a->used = 0;
+}
+
+void arena_destroy(Arena *a) {
+    ArenaChunk *c = a->first;
+    while (c) {
+        ArenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    a->first = a->cur = NULL;
+    a->used = 0;
+    a->nchunks = 0;
+}
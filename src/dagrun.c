@@ -0,0 +1,424 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dagrun.h"
+#include "exec.h"
+#include "parser.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define NO_LINE ((size_t)-1)
+
+/* One command line of the script and its place in the dependency graph */
+typedef struct {
+    size_t lineno;
+    CmdLine *cl;
+    int barrier;      /* changes shell state: runs alone, in the shell */
+    size_t nwait;     /* earlier lines it still waits for */
+    size_t *succ;     /* later lines waiting for this one */
+    size_t nsucc, succ_cap;
+    pid_t pgid;       /* while running */
+} DagLine;
+
+/* Who touched a file so far in the current stretch between barriers */
+typedef struct {
+    char *key;        /* absolute, normalized path; NULL = free slot */
+    size_t writer;    /* last line writing it, or NO_LINE */
+    size_t *readers;  /* lines reading it since that write */
+    size_t nreaders, readers_cap;
+} PathUse;
+
+/* Everything lives in this arena until the run is over */
+static Arena dag_arena;
+static DagLine *lines = NULL;
+static size_t nlines = 0;
+static const char *dag_src = NULL;
+
+static PathUse *paths = NULL;
+static size_t paths_cap = 0, npaths = 0;   /* power of two */
+
+/* Lines whose dependencies are all done, in line order of release */
+static size_t *ready = NULL;
+static size_t ready_head = 0, ready_tail = 0;
+static size_t nrunning = 0;
+static size_t nfailed = 0;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void dag_sigint(int signo) {
+    (void)signo;
+    interrupted = 1;
+}
+
+/* Builtins that act on the shell itself */
+static int changes_shell_state(const char *name) {
+    return strcmp(name, "hop") == 0 || strcmp(name, "log") == 0 ||
+           strcmp(name, "fg") == 0 || strcmp(name, "bg") == 0 ||
+           strcmp(name, "hash") == 0 || strcmp(name, "queue") == 0;
+}
+
+/* Make 'path' absolute against 'cwd' and drop '.', '..' and repeated '/' */
+static char *path_key(const char *cwd, const char *path) {
+    size_t clen = path[0] == '/' ? 0 : strlen(cwd);
+    size_t plen = strlen(path);
+    char *out = arena_alloc(&dag_arena, clen + plen + 3);
+    if (!out) return NULL;
+    size_t len = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        const char *s = pass == 0 ? cwd : path;
+        size_t n = pass == 0 ? clen : plen;
+        size_t i = 0;
+        while (i < n) {
+            while (i < n && s[i] == '/') i++;
+            size_t j = i;
+            while (j < n && s[j] != '/') j++;
+            size_t seg = j - i;
+            if (seg == 1 && s[i] == '.') {
+                /* nothing */
+            } else if (seg == 2 && s[i] == '.' && s[i + 1] == '.') {
+                while (len > 0 && out[len - 1] != '/') len--;
+                if (len > 0) len--;
+            } else if (seg > 0) {
+                out[len++] = '/';
+                memcpy(out + len, s + i, seg);
+                len += seg;
+            }
+            i = j;
+        }
+    }
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return out;
+}
+
+static size_t hash_str(const char *s) {
+    size_t h = 1469598103934665603ULL;
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    return h;
+}
+
+static PathUse *path_lookup(char *key) {
+    if (npaths * 2 >= paths_cap) {
+        size_t ncap = paths_cap ? paths_cap * 2 : 64;
+        PathUse *t = calloc(ncap, sizeof(PathUse));
+        if (!t) return NULL;
+        for (size_t i = 0; i < paths_cap; ++i) {
+            if (!paths[i].key) continue;
+            size_t h = hash_str(paths[i].key) & (ncap - 1);
+            while (t[h].key) h = (h + 1) & (ncap - 1);
+            t[h] = paths[i];
+        }
+        free(paths);
+        paths = t;
+        paths_cap = ncap;
+    }
+    size_t h = hash_str(key) & (paths_cap - 1);
+    while (paths[h].key) {
+        if (strcmp(paths[h].key, key) == 0) return &paths[h];
+        h = (h + 1) & (paths_cap - 1);
+    }
+    paths[h].key = key;
+    paths[h].writer = NO_LINE;
+    npaths++;
+    return &paths[h];
+}
+
+static void paths_clear(void) {
+    if (paths) memset(paths, 0, paths_cap * sizeof(PathUse));
+    npaths = 0;
+}
+
+/* Append v to an arena-backed array */
+static int push_index(size_t **arr, size_t *n, size_t *cap, size_t v) {
+    if (*n == *cap) {
+        size_t ncap = *cap ? *cap * 2 : 4;
+        size_t *t = arena_realloc(&dag_arena, *arr, *cap * sizeof(size_t),
+                                  ncap * sizeof(size_t));
+        if (!t) return -1;
+        *arr = t;
+        *cap = ncap;
+    }
+    (*arr)[(*n)++] = v;
+    return 0;
+}
+
+/* Line 'after' may only start once line 'before' is done */
+static int add_dep(size_t before, size_t after) {
+    if (before == after || before == NO_LINE) return 0;
+    DagLine *b = &lines[before];
+    if (push_index(&b->succ, &b->nsucc, &b->succ_cap, after) != 0) return -1;
+    lines[after].nwait++;
+    return 0;
+}
+
+static int use_path(const char *cwd, const char *file, int write, size_t li) {
+    char *key = path_key(cwd, file);
+    if (!key) return -1;
+    /* only regular files (or ones still to be created) carry data from one
+     * line to the next; /dev/null, ttys and FIFOs order nothing */
+    struct stat st;
+    if (stat(key, &st) == 0 && !S_ISREG(st.st_mode)) return 0;
+    PathUse *u = path_lookup(key);
+    if (!u) return -1;
+    if (add_dep(u->writer, li) != 0) return -1;
+    if (!write) return push_index(&u->readers, &u->nreaders, &u->readers_cap, li);
+    for (size_t k = 0; k < u->nreaders; ++k) {
+        if (add_dep(u->readers[k], li) != 0) return -1;
+    }
+    u->writer = li;
+    u->nreaders = 0;
+    return 0;
+}
+
+/* Dependencies among lines [from, to), none of which is a barrier */
+static int analyse(size_t from, size_t to) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    paths_clear();
+    for (size_t li = from; li < to; ++li) {
+        const CmdLine *cl = lines[li].cl;
+        for (size_t g = 0; g < cl->ngroups; ++g) {
+            for (size_t c = 0; c < cl->groups[g].ncmds; ++c) {
+                const CmdNode *n = &cl->groups[g].cmds[c];
+                if (n->infile && use_path(cwd, n->infile, 0, li) != 0) return -1;
+                if (n->outfile && use_path(cwd, n->outfile, 1, li) != 0) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+}
+
+static void line_done(size_t li, int code) {
+    if (code != 0) {
+        nfailed++;
+        fflush(stdout);
+        fprintf(stderr, "%s:%zu: exit %d\n", dag_src, lines[li].lineno, code);
+    }
+    for (size_t k = 0; k < lines[li].nsucc; ++k) {
+        size_t s = lines[li].succ[k];
+        if (--lines[s].nwait == 0) ready[ready_tail++] = s;
+    }
+}
+
+/* Job callback: the line's job has finished */
+static void dag_job_done(void *owner, int status) {
+    DagLine *l = owner;
+    l->pgid = 0;
+    nrunning--;
+    line_done((size_t)(l - lines), exit_code(status));
+}
+
+/* Run lines [from, to) as jobs, at most nslots at a time */
+static void run_stretch(size_t from, size_t to, size_t nslots) {
+    ready_head = ready_tail = 0;
+    for (size_t li = from; li < to; ++li) {
+        if (lines[li].nwait == 0) ready[ready_tail++] = li;
+    }
+    size_t started = 0;
+    int killed = 0;
+    while (started < to - from || nrunning > 0) {
+        while (!interrupted && nrunning < nslots && ready_head < ready_tail) {
+            size_t li = ready[ready_head++];
+            started++;
+            arena_reset(line_arena());
+            bg_job *job = exec_start_job(lines[li].cl->src);
+            if (!job) {
+                line_done(li, 127);
+                continue;
+            }
+            job->owner = &lines[li];
+            job->on_done = dag_job_done;
+            job->quiet = 1;
+            lines[li].pgid = job->pid;
+            nrunning++;
+        }
+        if (interrupted) {
+            for (size_t li = from; li < to && !killed; ++li) {
+                if (lines[li].pgid > 0) kill(-lines[li].pgid, SIGINT);
+            }
+            killed = 1;
+            if (nrunning == 0) return;
+        } else if (nrunning == 0) {
+            /* nothing running and nothing ready: cannot happen in a DAG */
+            return;
+        }
+        int fd = exec_sigchld_fd();
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, fd >= 0 ? 1 : 0, fd >= 0 ? -1 : 10);
+        reap_children();
+    }
+}
+
+/* Split text into lines and parse them all. Returns 0, or -1 after
+ * reporting syntax errors. */
+static int load_lines(const char *text, size_t len) {
+    size_t cap = 0;
+    size_t lineno = 0;
+    int bad = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t end = nl ? (size_t)(nl - text) : len;
+        size_t n = end - pos;
+        lineno++;
+        if (n > 0 && text[pos + n - 1] == '\r') n--;
+        size_t k = 0;
+        while (k < n && (text[pos + k] == ' ' || text[pos + k] == '\t')) k++;
+        if (k < n && text[pos + k] != '#') {
+            char *s = arena_strndup(&dag_arena, text + pos, n);
+            CmdLine *cl = s ? parse_command_line(&dag_arena, s) : NULL;
+            if (!cl) {
+                fprintf(stderr, "%s:%zu: Invalid Syntax!\n", dag_src, lineno);
+                bad = 1;
+            } else if (!bad) {
+                if (nlines == cap) {
+                    size_t ncap = cap ? cap * 2 : 256;
+                    DagLine *t = realloc(lines, ncap * sizeof(DagLine));
+                    if (!t) return -1;
+                    lines = t;
+                    cap = ncap;
+                }
+                DagLine *l = &lines[nlines++];
+                memset(l, 0, sizeof(*l));
+                l->lineno = lineno;
+                l->cl = cl;
+                for (size_t g = 0; g < cl->ngroups && !l->barrier; ++g) {
+                    for (size_t c = 0; c < cl->groups[g].ncmds; ++c) {
+                        if (changes_shell_state(cl->groups[g].cmds[c].argv[0])) l->barrier = 1;
+                    }
+                }
+            }
+        }
+        pos = nl ? end + 1 : len;
+    }
+    return bad ? -1 : 0;
+}
+
+/* Read the whole file: mapped if possible. *map says whether to munmap. */
+static char *read_script(int fd, size_t *len, int *map) {
+    struct stat st;
+    *map = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        *len = (size_t)st.st_size;
+        if (*len == 0) return NULL;
+        void *p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            *map = 1;
+            return p;
+        }
+    }
+    size_t cap = 64 * 1024, have = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        if (have == cap) {
+            char *t = realloc(buf, cap * 2);
+            if (!t) break;
+            buf = t;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + have, cap - have);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            *len = have;
+            return buf;
+        }
+        have += (size_t)r;
+    }
+    free(buf);
+    *len = 0;
+    return NULL;
+}
+
+int dagrun_file(const char *path, size_t nslots) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "shell.out: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    size_t len = 0;
+    int mapped = 0;
+    char *text = read_script(fd, &len, &mapped);
+    close(fd);
+
+    dag_src = path;
+    int ret = 0;
+    if (text && load_lines(text, len) != 0) ret = 255;
+    if (mapped) munmap(text, len);
+    else free(text);
+
+    ready = nlines ? malloc(nlines * sizeof(size_t)) : NULL;
+    if (nlines && !ready) ret = 1;
+
+    struct sigaction sa, old;
+    sa.sa_handler = dag_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, &old);
+
+    /* stretches of ordinary lines, separated by barriers run in the shell */
+    size_t from = 0;
+    while (ret == 0 && from < nlines && !interrupted) {
+        size_t to = from;
+        while (to < nlines && !lines[to].barrier) to++;
+        if (to > from) {
+            if (analyse(from, to) != 0) {
+                ret = 1;
+                break;
+            }
+            run_stretch(from, to, nslots);
+        }
+        if (to < nlines && !interrupted) {
+            arena_reset(line_arena());
+            exec_run_parsed(lines[to].cl);
+            if (exec_last_status() != 0) {
+                /* everything after a barrier was ordered after its effect
+                 * (a hop, say), which never happened: run no more */
+                nfailed++;
+                fflush(stdout);
+                fprintf(stderr, "%s:%zu: exit %d\n", dag_src, lines[to].lineno,
+                        exec_last_status());
+                if (to + 1 < nlines) {
+                    fprintf(stderr, "%s:%zu: stopping, %zu later lines not run\n", dag_src,
+                            lines[to].lineno, nlines - to - 1);
+                }
+                break;
+            }
+            to++;
+        }
+        from = to;
+    }
+    sigaction(SIGINT, &old, NULL);
+    fflush(stdout);
+
+    if (ret == 0) ret = interrupted ? 130 : (nfailed > 100 ? 100 : (int)nfailed);
+    free(paths);
+    paths = NULL;
+    paths_cap = npaths = 0;
+    free(ready);
+    ready = NULL;
+    free(lines);
+    lines = NULL;
+    nlines = 0;
+    arena_destroy(&dag_arena);
+    return ret;
+}
@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dircache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define DIRCACHE_INOTIFY 1
+#endif
+
+/* At most this many directories, and this many bytes of names + entries */
+#define DIRCACHE_MAX_ENTRIES 64
+#define DIRCACHE_MAX_BYTES (64u << 20)
+/* Without a watch, a directory modified this recently is not cached */
+#define DIRCACHE_RACY_SECS 2
+
+typedef struct CacheEntry {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;     /* the directory's mtime when it was read */
+    int wd;                    /* inotify watch, or -1 */
+    char *path;                /* as given when cached, for dircache_print */
+    DirListing dl;
+    size_t bytes;
+    unsigned long hits;
+    struct CacheEntry *prev, *next;   /* LRU list, most recent first */
+} CacheEntry;
+
+static CacheEntry *lru_head = NULL, *lru_tail = NULL;
+static size_t cache_count = 0;
+static size_t cache_bytes = 0;
+
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+/* Result of a lookup that could not be cached, kept until the next call */
+static DirListing scratch;
+
+static int watch_fd = -1;       /* inotify instance, opened on first use */
+static int watch_broken = 0;    /* inotify unavailable: mtime checks only */
+static pid_t watch_pid = 0;     /* process that opened watch_fd */
+
+static void lru_unlink(CacheEntry *e) {
+    if (e->prev) e->prev->next = e->next;
+    else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(CacheEntry *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+static void entry_drop(CacheEntry *e) {
+    lru_unlink(e);
+#ifdef DIRCACHE_INOTIFY
+    if (e->wd >= 0 && watch_fd >= 0) inotify_rm_watch(watch_fd, e->wd);
+#endif
+    cache_count--;
+    cache_bytes -= e->bytes;
+    dirlist_free(&e->dl);
+    free(e->path);
+    free(e);
+}
+
+#ifdef DIRCACHE_INOTIFY
+/* Drop the entries whose directories reported changes since the last call */
+static void drain_watch_events(void) {
+    if (watch_fd < 0) return;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        ssize_t r = read(watch_fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        for (ssize_t off = 0; off < r;) {
+            const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+            off += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events were lost: nothing can be trusted */
+                dircache_clear();
+                continue;
+            }
+            for (CacheEntry *e = lru_head; e; e = e->next) {
+                if (e->wd != ev->wd) continue;
+                /* IN_IGNORED: the kernel already removed the watch */
+                if (ev->mask & IN_IGNORED) e->wd = -1;
+                entry_drop(e);
+                break;
+            }
+        }
+    }
+}
+
+/* Watch the directory open as 'fd'; through /proc the watch lands on that
+ * very directory even if its path has since been renamed */
+static int add_watch(int fd, const char *path) {
+    if (watch_broken) return -1;
+    if (watch_fd < 0) {
+        watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watch_fd < 0) {
+            watch_broken = 1;
+            return -1;
+        }
+        watch_pid = getpid();
+    }
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                    IN_DELETE_SELF | IN_ONLYDIR;
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    int wd = inotify_add_watch(watch_fd, proc, mask);
+    if (wd < 0 && errno == ENOENT) wd = inotify_add_watch(watch_fd, path, mask);
+    return wd;
+}
+#endif
+
+/* A forked child shares the parent's inotify instance: reading it would
+ * steal the parent's events and removing watches would remove the
+ * parent's. The child forgets the instance and its copy of the cache. */
+static void check_owner(void) {
+    if (watch_fd < 0 || watch_pid == getpid()) return;
+    close(watch_fd);
+    watch_fd = -1;
+    for (CacheEntry *e = lru_head; e; e = e->next) e->wd = -1;
+    dircache_clear();
+}
+
+static CacheEntry *cache_find(dev_t dev, ino_t ino) {
+    for (CacheEntry *e = lru_head; e; e = e->next) {
+        if (e->dev == dev && e->ino == ino) return e;
+    }
+    return NULL;
+}
+
+/* Shrink a fresh listing to its contents; returns the bytes it holds */
+static size_t listing_trim(DirListing *dl) {
+    if (dl->names_cap > dl->names_len && dl->names_len > 0) {
+        char *t = realloc(dl->names, dl->names_len);
+        if (t) {
+            dl->names = t;
+            dl->names_cap = dl->names_len;
+        }
+    }
+    if (dl->cap > dl->n && dl->n > 0) {
+        RevealEnt *t = realloc(dl->ents, dl->n * sizeof(RevealEnt));
+        if (t) {
+            dl->ents = t;
+            dl->cap = dl->n;
+        }
+    }
+    return dl->names_cap + dl->cap * sizeof(RevealEnt);
+}
+
+const DirListing *dircache_listing(int fd, const char *path) {
+    dirlist_free(&scratch);
+    check_owner();
+#ifdef DIRCACHE_INOTIFY
+    drain_watch_events();
+#endif
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+
+    CacheEntry *e = cache_find(st.st_dev, st.st_ino);
+    if (e) {
+        if (e->mtime.tv_sec == st.st_mtim.tv_sec && e->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            e->hits++;
+            cache_hits++;
+            lru_unlink(e);
+            lru_push_front(e);
+            return &e->dl;
+        }
+        entry_drop(e);
+    }
+    cache_misses++;
+
+    /* watch first and take the mtime again, both before reading: a change
+     * made while reading then shows up as an event or a newer mtime */
+    int wd = -1;
+#ifdef DIRCACHE_INOTIFY
+    wd = add_watch(fd, path);
+#endif
+    DirListing dl;
+    memset(&dl, 0, sizeof(dl));
+    if (fstat(fd, &st) != 0 || dirlist_read(fd, &dl) != 0) {
+        int err = errno;
+#ifdef DIRCACHE_INOTIFY
+        if (wd >= 0) inotify_rm_watch(watch_fd, wd);
+#endif
+        dirlist_free(&dl);
+        errno = err;
+        return NULL;
+    }
+    size_t bytes = listing_trim(&dl);
+
+    int racy = 0;
+    if (wd < 0) {
+        time_t now = time(NULL);
+        racy = st.st_mtim.tv_sec + DIRCACHE_RACY_SECS > now;
+    }
+    e = NULL;
+    if (!racy && bytes <= DIRCACHE_MAX_BYTES) e = calloc(1, sizeof(CacheEntry));
+    if (e) e->path = strdup(path);
+    if (!e || !e->path) {
+#ifdef DIRCACHE_INOTIFY
+        if (wd >= 0) inotify_rm_watch(watch_fd, wd);
+#endif
+        if (e) free(e);
+        scratch = dl;
+        return &scratch;
+    }
+
+    while (lru_tail && (cache_count >= DIRCACHE_MAX_ENTRIES ||
+                        cache_bytes + bytes > DIRCACHE_MAX_BYTES)) {
+        entry_drop(lru_tail);
+    }
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->mtime = st.st_mtim;
+    e->wd = wd;
+    e->dl = dl;
+    e->bytes = bytes;
+    lru_push_front(e);
+    cache_count++;
+    cache_bytes += bytes;
+    return &e->dl;
+}
+
+void dircache_print(void) {
+    /* a forked child (reveal -C | ...) prints its copy as of the fork */
+#ifdef DIRCACHE_INOTIFY
+    if (watch_pid == getpid()) drain_watch_events();
+#endif
+    if (cache_count == 0) {
+        printf("reveal: listing cache empty\n");
+    } else {
+        printf("hits\tentries\tKB\tdirectory\n");
+        for (CacheEntry *e = lru_head; e; e = e->next) {
+            printf("%4lu\t%lu\t%lu\t%s%s\n", e->hits, (unsigned long)e->dl.n,
+                   (unsigned long)((e->bytes + 1023) / 1024), e->path,
+                   e->wd >= 0 ? "" : " (mtime)");
+        }
+    }
+    unsigned long total = cache_hits + cache_misses;
+    printf("%lu directories, %lu KB; lookups: %lu hits, %lu misses (%lu%% hit)\n",
+           (unsigned long)cache_count, (unsigned long)((cache_bytes + 1023) / 1024),
+           cache_hits, cache_misses, total ? cache_hits * 100 / total : 0);
+}
+
+void dircache_clear(void) {
+    while (lru_head) entry_drop(lru_head);
+}
+
+void dircache_cleanup(void) {
+    check_owner();
+    dircache_clear();
+    dirlist_free(&scratch);
+    if (watch_fd >= 0) close(watch_fd);
+    watch_fd = -1;
+}
@@ -1,6 +1,11 @@
 #define _POSIX_C_SOURCE 200809L
 #include "exec.h"
 #include "intrinsics.h"
+#include "arena.h"
+#include "pathcache.h"
+#include "parallel.h"
+#include "queue.h"
+#include "input.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,10 +17,29 @@
 #include <errno.h>
 #include <signal.h>
 #include <poll.h>
-#include <time.h>
+#include <spawn.h>
 
-bg_job *find_job_by_id(int id);
-bg_job *unlink_job(bg_job *job);
+extern char **environ;
+
+static int run_builtin(const CmdNode *c, int *status);
+
+/* Builtins that act on shell state and therefore run in the shell process
+ * when they make up a whole foreground command group.
+ */
+static int is_shell_builtin(const char *name) {
+    return strcmp(name, "hop") == 0 || strcmp(name, "reveal") == 0 ||
+           strcmp(name, "log") == 0 || strcmp(name, "activities") == 0 ||
+           strcmp(name, "ping") == 0 || strcmp(name, "fg") == 0 ||
+           strcmp(name, "bg") == 0 || strcmp(name, "hash") == 0 ||
+           strcmp(name, "queue") == 0;
+}
+
+/* Builtins that always run as a forked pipeline stage, so that they sit in
+ * the foreground process group and can wait on children of their own.
+ */
+static int is_stage_builtin(const char *name) {
+    return strcmp(name, "parallel") == 0;
+}
 
 int do_hop(char **argv) {
     size_t nargs = 0;
@@ -29,20 +53,38 @@ int do_reveal(char **argv) {
     return handle_reveal_args(argv + 1, nargs - 1);
 }
 
+/* Returns the exit status: the re-executed line's for "log execute" */
 int do_log(char **argv) {
     size_t nargs = 0;
     while (argv[nargs]) nargs++;
     char *dummy = NULL;
     int res = handle_log_args(argv + 1, nargs - 1, &dummy);
     if (res == 2) {
-        exec_run_line(dummy);
+        res = exec_run_line(dummy);
         free(dummy);
+        return res < 0 ? 2 : exec_last_status();
     }
-    return res;
+    return res < 0;
+}
+
+/* Exit status of the last foreground command group */
+static int last_status = 0;
+
+/* Shell convention for a wait status: the exit code, or 128+N for signal N */
+static int exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+}
+
+int exec_last_status(void) {
+    return last_status;
 }
 
 /* Foreground process group id, used by SIGINT handler */
 static pid_t shell_pid = 0;
+/* 0 while running a script or -c string */
+static int interactive = 1;
 volatile sig_atomic_t fg_pgid = 0;
 
 static void sigint_handler(int signo) {
@@ -61,498 +103,373 @@ static void sigtstp_handler(int signo) {
     }
 }
 
-/* Delimiters for tokenization */
-static int is_delim_char(char c) {
-    return (c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
-            c == '|' || c == '<' || c == '>' || c == ';' || c == '&');
-}
-
-/* Tokenize input into tokens where special symbols are separate tokens:
- * tokens are malloc'd strings and array is NULL-terminated.
- * Caller must free tokens and each token string.
+/* SIGCHLD self-pipe: the handler writes one byte per signal so that waiters
+ * can block in poll() instead of sleeping between waitpid() scans.
  */
-static char **tokenize_special(const char *line, size_t *out_count) {
-    if (!line) { if (out_count) *out_count = 0; return NULL; }
-    size_t cap = 16, n = 0;
-    char **arr = malloc(sizeof(char*) * cap);
-    if (!arr) return NULL;
-
-    const char *p = line;
-    while (*p) {
-        while (*p && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
-        if (!*p) break;
-
-        /* check special tokens */
-        if (*p == '|') {
-            char *t = strdup("|");
-            if (!t) goto fail;
-            arr[n++] = t;
-            ++p;
-        } else if (*p == '<') {
-            char *t = strdup("<");
-            if (!t) goto fail;
-            arr[n++] = t;
-            ++p;
-        } else if (*p == '>') {
-            if (p[1] == '>') {
-                char *t = strdup(">>");
-                if (!t) goto fail;
-                arr[n++] = t;
-                p += 2;
-            } else {
-                char *t = strdup(">");
-                if (!t) goto fail;
-                arr[n++] = t;
-                ++p;
-            }
-        } else if (*p == ';') {
-            char *t = strdup(";");
-            if (!t) goto fail;
-            arr[n++] = t;
-            ++p;
-        } else if (*p == '&') {
-            char *t = strdup("&");
-            if (!t) goto fail;
-            arr[n++] = t;
-            ++p;
-        } else {
-            /* name token: read until delim char */
-            const char *start = p;
-            while (*p && !is_delim_char(*p)) ++p;
-            size_t len = (size_t)(p - start);
-            char *t = malloc(len + 1);
-            if (!t) goto fail;
-            memcpy(t, start, len);
-            t[len] = '\0';
-            arr[n++] = t;
-        }
+static int sigchld_pipe[2] = { -1, -1 };
 
-        if (n + 2 >= cap) {
-            cap *= 2;
-            char **tmp = realloc(arr, sizeof(char*) * cap);
-            if (!tmp) goto fail;
-            arr = tmp;
-        }
+static void sigchld_handler(int signo) {
+    (void)signo;
+    int saved_errno = errno;
+    const char c = 0;
+    if (sigchld_pipe[1] >= 0) {
+        /* pipe is non-blocking: a full pipe already guarantees a wakeup */
+        ssize_t w = write(sigchld_pipe[1], &c, 1);
+        (void)w;
     }
-
-    arr[n] = NULL;
-    if (out_count) *out_count = n;
-    return arr;
-
-fail:
-    for (size_t i = 0; i < n; ++i) free(arr[i]);
-    free(arr);
-    if (out_count) *out_count = 0;
-    return NULL;
+    errno = saved_errno;
 }
 
-/* Free token array returned by tokenize_special */
-static void free_tokens(char **toks) {
-    if (!toks) return;
-    for (size_t i = 0; toks[i]; ++i) free(toks[i]);
-    free(toks);
+/* (Re)create the self-pipe. Both ends are non-blocking and close-on-exec so
+ * they never leak into commands. Returns 0 on success, -1 on error.
+ */
+static int sigchld_pipe_open(void) {
+    if (sigchld_pipe[0] >= 0) close(sigchld_pipe[0]);
+    if (sigchld_pipe[1] >= 0) close(sigchld_pipe[1]);
+    sigchld_pipe[0] = sigchld_pipe[1] = -1;
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    for (int i = 0; i < 2; ++i) {
+        int fl = fcntl(fds[i], F_GETFL);
+        if (fl >= 0) fcntl(fds[i], F_SETFL, fl | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    sigchld_pipe[0] = fds[0];
+    sigchld_pipe[1] = fds[1];
+    return 0;
 }
 
-/* A command node for a single stage in a pipeline */
-typedef struct {
-    char **argv;     /* NULL-terminated argv (malloc'd) */
-    char *infile;    /* or NULL */
-    char *outfile;   /* or NULL */
-    int append;      /* 1 for >>, 0 for > */
-} CmdNode;
-
-/* Free a CmdNode */
-static void free_cmdnode(CmdNode *c) {
-    if (!c) return;
-    if (c->argv) {
-        for (size_t i = 0; c->argv[i]; ++i) free(c->argv[i]);
-        free(c->argv);
+/* Consume all pending wakeup bytes */
+static void drain_sigchld_pipe(void) {
+    char buf[64];
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+        /* keep draining */
     }
-    free(c->infile);
-    free(c->outfile);
-    c->argv = NULL;
-    c->infile = NULL;
-    c->outfile = NULL;
 }
 
-/* Build commands until first ';' or '&' token (first cmd_group only) */
-static int build_pipeline_from_tokens(char **toks, size_t ntoks, CmdNode **out_cmds, size_t *out_ncmds) {
-    if (!toks) return -1;
-    /* Use all tokens in this command group */
-    size_t limit = ntoks;
-    /* Now split by '|' into command token ranges */
-    size_t start = 0;
-    size_t cmdcap = 8, cmdcount = 0;
-    CmdNode *cmds = malloc(sizeof(CmdNode) * cmdcap);
-    if (!cmds) return -1;
-
-    while (start < limit) {
-        /* find next '|' or end */
-        size_t end = start;
-        while (end < limit && strcmp(toks[end], "|") != 0) ++end;
-        /* parse tokens [start, end) into one CmdNode */
-        CmdNode node;
-        node.argv = NULL;
-        node.infile = NULL;
-        node.outfile = NULL;
-        node.append = 0;
-
-        /* build argv: first pass count arguments that are not redirections */
-        size_t argc = 0;
-        for (size_t i = start; i < end; ++i) {
-            if (strcmp(toks[i], "<") == 0 || strcmp(toks[i], ">") == 0 || strcmp(toks[i], ">>") == 0) {
-                ++i; /* skip next token when counting; assume valid syntax from parser */
-                continue;
-            } else {
-                ++argc;
-            }
-        }
-        /* allocate argv array (argc + 1) */
-        node.argv = malloc(sizeof(char*) * (argc + 1));
-        if (!node.argv) { free_cmdnode(&node); goto fail_nodes; }
-        size_t ai = 0;
-        size_t i = start;
-        while (i < end) {
-            if (strcmp(toks[i], "<") == 0) {
-                /* input */
-                if (i + 1 >= end) { /* malformed */ free_cmdnode(&node); goto fail_nodes; }
-                free(node.infile);
-                node.infile = strdup(toks[i+1]);
-                i += 2;
-            } else if (strcmp(toks[i], ">") == 0) {
-                if (i + 1 >= end) { free_cmdnode(&node); goto fail_nodes; }
-                free(node.outfile);
-                node.outfile = strdup(toks[i+1]);
-                node.append = 0;
-                i += 2;
-            } else if (strcmp(toks[i], ">>") == 0) {
-                if (i + 1 >= end) { free_cmdnode(&node); goto fail_nodes; }
-                free(node.outfile);
-                node.outfile = strdup(toks[i+1]);
-                node.append = 1;
-                i += 2;
-            } else {
-                node.argv[ai++] = strdup(toks[i]);
-                i += 1;
-            }
+/* pipe() with both ends close-on-exec, so spawned stages only ever see the
+ * descriptors dup'ed onto their stdin/stdout.
+ */
+static int cloexec_pipe(int fds[2]) {
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+/* Open one stage's '<' and '>'/'>>' targets in the shell (close-on-exec).
+ * Unused slots are set to -1. On failure the error is printed, anything
+ * already opened is closed and -1 is returned.
+ */
+static int open_stage_redirs(const CmdNode *c, int *in_fd, int *out_fd) {
+    *in_fd = -1;
+    *out_fd = -1;
+    if (c->infile) {
+        *in_fd = open(c->infile, O_RDONLY | O_CLOEXEC);
+        if (*in_fd < 0) {
+            /* per spec */
+            printf("No such file or directory\n");
+            return -1;
         }
-        node.argv[ai] = NULL;
-        /* Store command */
-        if (cmdcount + 1 >= cmdcap) {
-            cmdcap *= 2;
-            CmdNode *tmp = realloc(cmds, sizeof(CmdNode) * cmdcap);
-            if (!tmp) { free_cmdnode(&node); goto fail_nodes; }
-            cmds = tmp;
+    }
+    if (c->outfile) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        if (c->append) flags |= O_APPEND;
+        else flags |= O_TRUNC;
+        *out_fd = open(c->outfile, flags, 0644);
+        if (*out_fd < 0) {
+            printf("Unable to create file for writing\n");
+            if (*in_fd >= 0) close(*in_fd);
+            *in_fd = -1;
+            return -1;
         }
-        cmds[cmdcount++] = node;
-
-        /* advance past '|' */
-        start = end + 1;
     }
-
-    *out_cmds = cmds;
-    *out_ncmds = cmdcount;
     return 0;
-
-fail_nodes:
-    for (size_t k = 0; k < cmdcount; ++k) free_cmdnode(&cmds[k]);
-    free(cmds);
-    return -1;
 }
 
-/* Close an array of pipes (n pipes => array size n x 2) */
-static void close_pipes(int (*pipes)[2], size_t n) {
-    if (!pipes) return;
-    for (size_t i = 0; i < n; ++i) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+/* Start an external command with posix_spawn (glibc implements it with
+ * clone(CLONE_VM|CLONE_VFORK), so no page tables are copied). in_fd/out_fd
+ * become the child's stdin/stdout unless -1. pgid 0 starts a new group.
+ * Returns the pid, or -1 with errno set.
+ */
+static pid_t spawn_stage(const char *path, char *const argv[], int in_fd, int out_fd, pid_t pgid) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    if (posix_spawn_file_actions_init(&fa) != 0) return -1;
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        return -1;
+    }
+    /* an fd already in place only needs to survive the exec */
+    if (in_fd == STDIN_FILENO) fcntl(in_fd, F_SETFD, 0);
+    else if (in_fd >= 0) posix_spawn_file_actions_adddup2(&fa, in_fd, STDIN_FILENO);
+    if (out_fd == STDOUT_FILENO) fcntl(out_fd, F_SETFD, 0);
+    else if (out_fd >= 0) posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO);
+
+    sigset_t none, defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGCHLD);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        errno = err;
+        return -1;
     }
+    return pid;
 }
 
-/* Run the parsed pipeline of commands.
- * Returns 0 on normal completion, -1 on failure (alloc/parse).
+/* Fork a stage that has to run shell code: builtins inside pipelines, and
+ * scripts without a #! line (execvp hands those to /bin/sh).
+ * close_fd is a descriptor the child must not keep (the next stage's pipe
+ * read end), or -1.
  */
-static int run_cmd_pipeline(CmdNode *cmds, size_t ncmds, const char *leader_cmd) {
-    if (ncmds == 0) return 0;
-
-    /* Create pipes: ncmds-1 pipes */
-    size_t npipes = (ncmds > 1) ? ncmds - 1 : 0;
-    int (*pipes)[2] = NULL;
-    if (npipes) {
-        pipes = malloc(sizeof(int[2]) * npipes);
-        if (!pipes) return -1;
-        for (size_t i = 0; i < npipes; ++i) {
-            if (pipe(pipes[i]) != 0) {
-                /* close previous pipes */
-                for (size_t j = 0; j < i; ++j) {
-                    close(pipes[j][0]); close(pipes[j][1]);
-                }
-                free(pipes);
-                return -1;
-            }
+static pid_t fork_stage(const CmdNode *c, const char *path, int in_fd, int out_fd,
+                        pid_t pgid, int close_fd) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid > 0) {
+        /* put child into leader's process group */
+        if (setpgid(pid, pgid ? pgid : pid) != 0) {
+            /* ignore errors */
         }
+        return pid;
     }
+    /* Child */
+    setpgid(0, pgid);
+    /* terminal signals act on the stage itself; keep a private self-pipe so
+     * builtins that start children never steal the shell's wakeups */
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    sigchld_pipe_open();
+    if (in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) _exit(1);
+    if (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) _exit(1);
+    if (close_fd >= 0) close(close_fd);
+
+    int status;
+    if (run_builtin(c, &status)) {
+        fflush(stdout);
+        _exit(status);
+    }
+    execvp(path, c->argv);
+    printf("Command not found!\n");
+    _exit(127);
+}
 
-    pid_t *pids = malloc(sizeof(pid_t) * ncmds);
-    if (!pids) { if (pipes) close_pipes(pipes, npipes); free(pipes); return -1; }
-
-    pid_t leader = -1;
+/* Start all stages of a pipeline in process group 'pgid' (0 = a new group
+ * led by the first stage). in_fd/out_fd replace the first stage's stdin and
+ * the last stage's stdout (-1 = inherit from the shell). pids[i] receives
+ * each stage's pid, or -1 if that stage could not be started (error already
+ * printed). Returns the process group id, or -1 if no stage started.
+ */
+pid_t launch_pipeline(const CmdNode *cmds, size_t ncmds, int in_fd, int out_fd,
+                      pid_t pgid, pid_t *pids) {
+    pid_t leader = pgid;
+    int started = 0;
+    int prev_read = in_fd;   /* stdin for the current stage */
+    /* what the shell printed so far goes out before the stages' output */
+    fflush(stdout);
 
     for (size_t i = 0; i < ncmds; ++i) {
-        pid_t pid = fork();
-        if (pid < 0) {
-            /* fork failed: close pipes and continue (attempt to run remaining?) */
-            pids[i] = -1;
-            continue;
-        } else if (pid == 0) {
-            /* Child */
-            /* If not first, redirect stdin from previous pipe read end */
-            if (i > 0) {
-                if (dup2(pipes[i-1][0], STDIN_FILENO) < 0) { _exit(1); }
-            }
-            /* If not last, redirect stdout to current pipe write end */
-            if (i < ncmds - 1) {
-                if (dup2(pipes[i][1], STDOUT_FILENO) < 0) { _exit(1); }
-            }
-            /* Close all pipe fds in child */
-            if (pipes) {
-                for (size_t j = 0; j < npipes; ++j) {
-                    close(pipes[j][0]); close(pipes[j][1]);
-                }
+        const CmdNode *c = &cmds[i];
+        int pfd[2] = { -1, -1 };
+        pids[i] = -1;
+
+        if (i + 1 < ncmds && cloexec_pipe(pfd) != 0) {
+            perror("pipe");
+            break;
+        }
+        int stage_in = prev_read;
+        int stage_out = (i + 1 < ncmds) ? pfd[1] : out_fd;
+
+        /* Resolve external commands through the PATH cache before starting
+         * anything, so a missing command costs no process at all.
+         */
+        const char *name = c->argv[0];
+        const char *path = NULL;
+        int builtin = is_shell_builtin(name) || is_stage_builtin(name);
+        if (!builtin) {
+            path = strchr(name, '/') ? name : pathcache_lookup(name);
+            if (!path) {
+                printf("Command not found!\n");
+                fflush(stdout);
             }
+        }
 
-            /* Handle redirections in child */
-            if (cmds[i].infile) {
-                int infd = open(cmds[i].infile, O_RDONLY);
-                if (infd < 0) {
-                    /* per spec */
-                    printf("No such file or directory\n");
-                    _exit(1);
+        int rin = -1, rout = -1;
+        if ((builtin || path) && open_stage_redirs(c, &rin, &rout) == 0) {
+            /* explicit redirections win over the pipe */
+            if (rin >= 0) stage_in = rin;
+            if (rout >= 0) stage_out = rout;
+            fflush(stdout);
+            pid_t pid;
+            if (builtin) {
+                pid = fork_stage(c, NULL, stage_in, stage_out, leader, pfd[0]);
+            } else {
+                pid = spawn_stage(path, c->argv, stage_in, stage_out, leader);
+                if (pid < 0 && errno == ENOEXEC) {
+                    pid = fork_stage(c, path, stage_in, stage_out, leader, pfd[0]);
+                } else if (pid < 0) {
+                    printf("Command not found!\n");
                 }
-                if (dup2(infd, STDIN_FILENO) < 0) { close(infd); _exit(1); }
-                close(infd);
             }
-            if (cmds[i].outfile) {
-                int flags = O_WRONLY | O_CREAT;
-                if (cmds[i].append) flags |= O_APPEND;
-                else flags |= O_TRUNC;
-                int outfd = open(cmds[i].outfile, flags, 0644);
-                if (outfd < 0) {
-                    printf("Unable to create file for writing\n");
-                    _exit(1);
-                }
-                if (dup2(outfd, STDOUT_FILENO) < 0) { close(outfd); _exit(1); }
-                close(outfd);
+            if (pid > 0) {
+                pids[i] = pid;
+                started = 1;
+                if (leader == 0) leader = pid;
             }
+            if (rin >= 0) close(rin);
+            if (rout >= 0) close(rout);
+        }
 
-            /* Exec the command if there is an argv */
-            if (!cmds[i].argv || !cmds[i].argv[0]) {
-                /* nothing to exec */
-                _exit(0);
-            }
-            if (strcmp(cmds[i].argv[0], "hop") == 0) {
-                do_hop(cmds[i].argv);
-                _exit(0);
-            } else if (strcmp(cmds[i].argv[0], "reveal") == 0) {
-                do_reveal(cmds[i].argv);
-                _exit(0);
-            } else if (strcmp(cmds[i].argv[0], "log") == 0) {
-                do_log(cmds[i].argv);
-                _exit(0);
-            } else if (strcmp(cmds[i].argv[0], "activities") == 0) {
-                print_activities();
-                _exit(0);
-            } else if (strcmp(cmds[i].argv[0], "ping") == 0) {
-                size_t nargs = 0;
-                while (cmds[i].argv[nargs]) nargs++;
-                if (nargs != 3) {
-                    printf("Invalid syntax!\n");
-                    _exit(1);
-                }
-                char *endptr;
-                long pid = strtol(cmds[i].argv[1], &endptr, 10);
-                if (*endptr != '\0') {
-                    printf("Invalid syntax!\n");
-                    _exit(1);
-                }
-                long sig = strtol(cmds[i].argv[2], &endptr, 10);
-                if (*endptr != '\0') {
-                    printf("Invalid syntax!\n");
-                    _exit(1);
-                }
-                int actual_sig = (int)(sig % 32);
-                if (actual_sig <= 0) actual_sig += 32;
-                if (kill((pid_t)pid, actual_sig) < 0) {
-                    if (errno == ESRCH) printf("No such process found\n");
-                    else perror("kill");
-                } else {
-                    printf("Sent signal %ld to process with pid %ld\n", sig, pid);
-                }
-                _exit(0);
-            } else if (strcmp(cmds[i].argv[0], "fg") == 0 || strcmp(cmds[i].argv[0], "bg") == 0) {
-                int is_fg = (strcmp(cmds[i].argv[0], "fg") == 0);
-                size_t nargs = 0;
-                while (cmds[i].argv[nargs]) nargs++;
-                int job_num = -1;
-                if (nargs == 1) {
-                    if (!job_list) {
-                        printf("No such job\n");
-                        _exit(1);
-                    }
-                    job_num = job_list->job_id;
-                } else if (nargs == 2) {
-                    char *endptr;
-                    long v = strtol(cmds[i].argv[1], &endptr, 10);
-                    if (*endptr != '\0') {
-                        printf("No such job\n");
-                        _exit(1);
-                    }
-                    job_num = (int)v;
-                } else {
-                    printf("Invalid syntax!\n");
-                    _exit(1);
-                }
-                bg_job *job = find_job_by_id(job_num);
-                if (!job) {
-                    printf("No such job\n");
-                    _exit(1);
-                }
-                if (is_fg) {
-                    if (job->stopped) {
-                        if (kill(job->pid, SIGCONT) < 0) perror("kill");
-                        job->stopped = 0;
-                    }
-                    unlink_job(job);
-                    printf("%s\n", job->command);
-                    fflush(stdout);
-                    fg_pgid = job->pid;
-                    int st;
-                    pid_t w = waitpid(-job->pid, &st, WUNTRACED);
-                    if (w > 0 && WIFSTOPPED(st)) {
-                        add_stopped_job(job->pid, job->command);
-                    }
-                    fg_pgid = 0;
-                    free(job->command);
-                    free(job);
-                } else {
-                    if (!job->stopped) {
-                        printf("Job already running\n");
-                    } else {
-                        if (kill(job->pid, SIGCONT) < 0) {
-                            if (errno == ESRCH) printf("No such job\n");
-                            else perror("kill");
-                        } else {
-                            job->stopped = 0;
-                            printf("[%d] %s &\n", job->job_id, job->command);
-                        }
-                    }
-                }
-                _exit(0);
-            } else {
-                execvp(cmds[i].argv[0], cmds[i].argv);
-                printf("Command not found!\n");
-                _exit(127);
-            }
-        } else {
-            /* Parent */
-            pids[i] = pid;
-            if (leader == -1) leader = pid;
-            /* put child into leader's process group */
-            if (setpgid(pid, leader) != 0) {
-                /* ignore errors */
+        /* the shell keeps no pipe ends: stages hold their own copies */
+        if (prev_read >= 0 && prev_read != in_fd) close(prev_read);
+        if (pfd[1] >= 0) close(pfd[1]);
+        prev_read = pfd[0];
+    }
+    if (prev_read >= 0 && prev_read != in_fd) close(prev_read);
+    return started ? leader : -1;
+}
+
+/* Stages of the pipeline the shell is currently waiting on in the
+ * foreground; reap_children() checks these before the job table.
+ */
+static struct {
+    pid_t *pids;       /* reaped entries are set to -1 */
+    size_t n;
+    size_t remaining;
+    int stopped;
+    int status;        /* wait status of the last stage */
+} fg_wait;
+
+/* Wait for a foreground pipeline whose stages are pids[0..n) (reaped
+ * entries are set to -1). Returns 1 if a stage stopped (the caller then
+ * keeps the pipeline as a stopped job), 0 once every stage has finished;
+ * *status (if not NULL) then holds the wait status of the last stage. If
+ * that stage is already gone (never started, or reaped earlier), *status
+ * must hold its status on entry and is left alone.
+ */
+static int wait_foreground(pid_t *pids, size_t n, int *status) {
+    /* Event-driven wait: block in poll() on the SIGCHLD self-pipe and stdin.
+     * Every child state change writes a byte to the pipe and reap_children()
+     * collects all of them with waitpid(-1), so we never sleep on a timer.
+     * Polling stdin as well keeps Ctrl-D detection immediate while the
+     * pipeline runs; anything else typed meanwhile is kept for the next
+     * prompt.
+     */
+    fg_wait.pids = pids;
+    fg_wait.n = n;
+    fg_wait.remaining = 0;
+    fg_wait.stopped = 0;
+    fg_wait.status = status ? *status : 0;
+    for (size_t i = 0; i < n; ++i) if (pids[i] > 0) fg_wait.remaining++;
+    /* a script's commands may read stdin themselves: leave it to them */
+    int stdin_fd = interactive ? STDIN_FILENO : -1;
+
+    while (1) {
+        /* Reap whatever changed state since the last wakeup */
+        reap_children();
+        if (fg_wait.stopped || fg_wait.remaining == 0) break;
+        /* slots freed by background jobs go to queued entries right away */
+        queue_schedule();
+
+        struct pollfd pfds[2];
+        pfds[0].fd = sigchld_pipe[0];
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = stdin_fd;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+
+        /* without a self-pipe there is nothing to wake us: fall back to ticks */
+        int pres = poll(pfds, 2, sigchld_pipe[0] >= 0 ? queue_poll_timeout() : 10);
+        if (pres < 0) {
+            /* EINTR: the SIGCHLD byte is already queued in the pipe */
+            continue;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            /* Keep what the user types ahead in the shell's input buffer;
+             * the next prompt starts from it. */
+            long r = input_fill();
+            if (r == 0) {
+                /* EOF (Ctrl-D at empty line): exit now unless lines are
+                 * still buffered, in which case they run first */
+                if (input_pending() == 0) handle_eof_exit(); /* does not return */
+                stdin_fd = -1;
+            } else if (r > 0 && input_tail_contains((size_t)r, 4)) {
+                /* an explicit EOT char keeps exiting right away */
+                handle_eof_exit();
             }
-            /* parent continues to spawn next */
+        } else if (pfds[1].revents & POLLNVAL) {
+            /* stdin closed: stop watching it */
+            stdin_fd = -1;
+        } else if (pfds[1].revents & (POLLHUP | POLLERR)) {
+            /* treat as EOF */
+            if (input_pending() == 0) handle_eof_exit();
+            stdin_fd = -1;
         }
     }
+    int stopped = fg_wait.stopped;
+    if (status) *status = fg_wait.status;
+    memset(&fg_wait, 0, sizeof(fg_wait));
+    return stopped;
+}
 
-    /* Parent: close all pipe fds (it doesn't use them) */
-    if (pipes) {
-        for (size_t j = 0; j < npipes; ++j) {
-            close(pipes[j][0]); close(pipes[j][1]);
+/* Record a state change of one of the foreground stages.
+ * Returns 0 if 'pid' is not part of the foreground pipeline.
+ */
+static int fg_wait_update(pid_t pid, int status) {
+    for (size_t i = 0; i < fg_wait.n; ++i) {
+        if (fg_wait.pids[i] != pid) continue;
+        if (WIFSTOPPED(status)) {
+            fg_wait.stopped = 1;
+        } else if (!WIFCONTINUED(status)) {
+            if (i == fg_wait.n - 1) fg_wait.status = status;
+            fg_wait.pids[i] = -1;
+            fg_wait.remaining--;
         }
-        free(pipes);
+        return 1;
     }
+    return 0;
+}
 
-    /* Set foreground pgid for signal handler */
-    if (leader > 0) fg_pgid = leader;
+/* Run the parsed pipeline of commands.
+ * Returns 0 on normal completion, -1 on failure (alloc/parse).
+ */
+static int run_cmd_pipeline(const CmdNode *cmds, size_t ncmds, const char *leader_cmd) {
+    if (ncmds == 0) return 0;
 
-    /* Non-blocking wait loop: poll stdin for EOF/EOT while reaping children.
-     * This allows immediate detection of Ctrl-D even while a foreground pipeline
-     * is running. If EOF/EOT is seen, call handle_eof_exit() which will cleanup.
-     */
-    {
-        int remaining = 0;
-        for (size_t i = 0; i < ncmds; ++i) if (pids[i] > 0) remaining++;
-        int status;
-        struct pollfd pfd;
-        pfd.fd = STDIN_FILENO;
-        pfd.events = POLLIN;
-
-        while (remaining > 0) {
-            /* Check for any child state changes without blocking */
-            for (size_t i = 0; i < ncmds; ++i) {
-                if (pids[i] <= 0) continue;
-                pid_t w = waitpid(pids[i], &status, WNOHANG | WUNTRACED);
-                if (w == 0) continue; /* still running */
-                if (w == -1) {
-                    /* error; treat as gone */
-                    pids[i] = -1;
-                    remaining--;
-                    continue;
-                }
-                /* w > 0: child changed state */
-                if (WIFSTOPPED(status)) {
-                    /* Move entire pipeline to background as stopped */
-                    add_stopped_job(leader, leader_cmd ? leader_cmd : (cmds[0].argv ? cmds[0].argv[0] : ""));
-                    /* mark all pids as handled to break outer wait */
-                    remaining = 0;
-                    break;
-                } else {
-                    /* exited or signaled: mark this pid as handled */
-                    pids[i] = -1;
-                    remaining--;
-                }
-            }
+    pid_t *pids = arena_alloc(line_arena(), sizeof(pid_t) * ncmds);
+    if (!pids) return -1;
 
-            /* Poll stdin briefly to detect EOF/EOT */
-            int pres = poll(&pfd, 1, 100); /* 100 ms */
-            if (pres > 0) {
-                if (pfd.revents & POLLIN) {
-                    /* Attempt to read (non-destructive read) */
-                    char buf[16];
-                    ssize_t r = read(STDIN_FILENO, buf, sizeof(buf));
-                    if (r == 0) {
-                        /* EOF on terminal (Ctrl-D at empty line) */
-                        handle_eof_exit(); /* does not return */
-                    } else if (r > 0) {
-                        /* If an explicit EOT char was sent (rare in canonical mode),
-                         * detect it and exit. Otherwise, we consumed input that
-                         * might belong to the user; best-effort: if EOT present exit.
-                         */
-                        for (ssize_t bi = 0; bi < r; ++bi) {
-                            if ((unsigned char)buf[bi] == 4) { /* EOT */
-                                handle_eof_exit();
-                            }
-                        }
-                        /* In canonical mode this read returns pending line data
-                         * (or part of it). We don't try to reinsert it; the
-                         * typical case of Ctrl-D at empty line is handled above.
-                         */
-                    }
-                } else if (pfd.revents & (POLLHUP | POLLERR)) {
-                    /* treat as EOF */
-                    handle_eof_exit();
-                }
-            }
+    pid_t leader = launch_pipeline(cmds, ncmds, -1, -1, 0, pids);
+    if (leader < 0) {
+        last_status = 127;
+        return 0;
+    }
 
-            /* Small sleep to avoid busy-looping when nothing changes */
-            if (remaining > 0) {
-                /* If no child state change detected this iteration, sleep shortly */
-                struct timespec ts = { .tv_sec = 0, .tv_nsec = 10000000 };
-                nanosleep(&ts, NULL);
-            }
-        }
-        free(pids);
+    /* Set foreground pgid for signal handler */
+    fg_pgid = leader;
+    /* a last stage that never started fails the pipeline, as for jobs */
+    int status = pids[ncmds - 1] > 0 ? 0 : 127 << 8;
+    if (wait_foreground(pids, ncmds, &status)) {
+        /* Move entire pipeline to background as stopped */
+        add_stopped_job(leader, pids, cmds, ncmds,
+                        leader_cmd ? leader_cmd : (cmds[0].argv ? cmds[0].argv[0] : ""));
+        last_status = 128 + SIGTSTP;
+    } else {
+        last_status = exit_code(status);
     }
 
     /* Clear foreground pgid */
@@ -560,253 +477,261 @@ static int run_cmd_pipeline(CmdNode *cmds, size_t ncmds, const char *leader_cmd)
     return 0;
 }
 
-/* Global job list */
-bg_job *job_list = NULL;
-static int next_job_id = 1;
-
-void add_background_job(pid_t pid, const char *cmd) {
-    bg_job *new_job = malloc(sizeof(bg_job));
-    new_job->pid = pid;
-    new_job->job_id = next_job_id++;
-    new_job->command = strdup(cmd);
-    new_job->stopped = 0;
-    new_job->next = job_list;
-    job_list = new_job;
-    
-    printf("[%d] %d\n", new_job->job_id, pid);
-    fflush(stdout);
-}
+static bg_job *new_job(pid_t pgid, const pid_t *pids, const CmdNode *cmds, size_t n,
+                       const char *cmd, int stopped);
 
-void add_stopped_job(pid_t pid, const char *cmd) {
-    bg_job *new_job = malloc(sizeof(bg_job));
-    new_job->pid = pid;
-    new_job->job_id = next_job_id++;
-    new_job->command = strdup(cmd);
-    new_job->stopped = 1;
-    new_job->next = job_list;
-    job_list = new_job;
-    printf("[%d] Stopped %s\n", new_job->job_id, new_job->command);
-    fflush(stdout);
-}
+/* Launch a '&' group straight from the shell: the stages form their own
+ * process group, read /dev/null instead of the terminal, and are tracked
+ * individually in the job record. No intermediate shell is forked.
+ * Returns the job, or NULL if nothing started.
+ */
+static bg_job *run_background_pipeline(const CmdGroup *g) {
+    pid_t *pids = arena_alloc(line_arena(), sizeof(pid_t) * g->ncmds);
+    if (!pids) return NULL;
 
-void check_background_jobs() {
-    bg_job *job = job_list;
-    bg_job *prev = NULL;
-    int job_finished = 0;
-    while (job != NULL) {
-        int status;
-        pid_t result = waitpid(job->pid, &status, WNOHANG);
-        if (result > 0) {
-            /* Print completion status */
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                printf("\n%s with pid %d exited normally\n", job->command, job->pid);
-            } else {
-                printf("\n%s with pid %d exited abnormally\n", job->command, job->pid);
-            }
-            fflush(stdout);
-            /* Remove job from list */
-            if (prev) {
-                prev->next = job->next;
-            } else {
-                job_list = job->next;
-            }
-            bg_job *tmp = job;
-            job = job->next;
-            free(tmp->command);
-            free(tmp);
-            job_finished = 1;
-        } else {
-            prev = job;
-            job = job->next;
-        }
-    }
-    if (job_finished) {
-        printf("\n");
-        fflush(stdout);
-    }
-}
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pid_t leader = launch_pipeline(g->cmds, g->ncmds, null_fd, -1, 0, pids);
+    if (null_fd >= 0) close(null_fd);
+    if (leader < 0) return NULL;
 
-void execute_sequential_commands(char **commands, int count) {
-    for (int i = 0; i < count; i++) {
-        // Trim whitespace
-        char *cmd = commands[i];
-        while (*cmd == ' ' || *cmd == '\t') cmd++;
-        
-        if (strlen(cmd) > 0) {
-            // Execute each command in sequence
-            execute_command(cmd);
-            // Wait for completion before next command
-            wait(NULL);
-        }
-    }
+    return new_job(leader, pids, g->cmds, g->ncmds, g->text, 0);
 }
 
-void execute_background_command(char *command) {
+/* Run a line of several command groups in a forked copy of the shell,
+ * which is a single job as far as this shell is concerned.
+ */
+static bg_job *run_background_line(const CmdLine *cl) {
+    fflush(stdout);
     pid_t pid = fork();
-    
+    if (pid < 0) return NULL;
     if (pid == 0) {
-        /* Child process */
-        /* Create new process group */
         setpgid(0, 0);
-        
-        /* Redirect stdin to /dev/null */
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        sigchld_pipe_open();
         int null_fd = open("/dev/null", O_RDONLY);
-        if (null_fd != -1) {
+        if (null_fd >= 0) {
             dup2(null_fd, STDIN_FILENO);
             close(null_fd);
         }
-        
-        /* Execute the command */
-        execute_command(command);
-        
-        /* Exit with status based on command success */
-        if (errno) {
-            exit(1);
-        }
-        exit(0);
-    } else if (pid > 0) {
-        /* Parent process */
-        setpgid(pid, pid);
-        add_background_job(pid, command);
-    } else {
-        perror("fork failed");
+        interactive = 0;
+        exec_run_parsed(cl);
+        fflush(stdout);
+        _exit(last_status);
     }
+    setpgid(pid, pid);
+    return new_job(pid, &pid, NULL, 1, cl->src, 0);
 }
 
-void execute_command(char *command) {
-    pid_t pid = fork();
-    
-    if (pid == 0) {
-        // Child process
-        char *args[256];
-        int arg_count = 0;
-        
-        // Parse command into arguments
-        char *token = strtok(command, " \t\n");
-        while (token != NULL && arg_count < 255) {
-            args[arg_count++] = token;
-            token = strtok(NULL, " \t\n");
-        }
-        args[arg_count] = NULL;
-        
-        // Execute command
-        execvp(args[0], args);
-        
-        // If execvp returns, there was an error
-        printf("Command not found!\n");
-        exit(1);
-    } else if (pid < 0) {
-        perror("fork failed");
+/* Start 'line' as a background job without the "[id] pid" notice: one
+ * command group as its pipeline, several in a forked shell. Returns the
+ * job, or NULL if it could not be parsed or nothing started.
+ */
+bg_job *exec_start_job(const char *line) {
+    Arena *arena = line_arena();
+    ArenaMark mark = arena_mark(arena);
+    bg_job *job = NULL;
+    CmdLine *cl = parse_command_line(arena, line);
+    if (cl && cl->ngroups == 1) job = run_background_pipeline(&cl->groups[0]);
+    else if (cl) job = run_background_line(cl);
+    arena_rewind(arena, mark);
+    return job;
+}
+
+/* Finished jobs waiting for their completion notice, oldest first */
+static bg_job *done_head = NULL;
+static bg_job *done_tail = NULL;
+
+/* Render one stage of a pipeline for 'activities': its argv, space separated */
+static char *stage_name(const CmdNode *c) {
+    size_t len = 1;
+    for (size_t i = 0; i < c->argc; ++i) len += strlen(c->argv[i]) + 1;
+    char *s = arena_alloc(line_arena(), len);
+    if (!s) return NULL;
+    char *p = s;
+    for (size_t i = 0; i < c->argc; ++i) {
+        size_t n = strlen(c->argv[i]);
+        if (i) *p++ = ' ';
+        memcpy(p, c->argv[i], n);
+        p += n;
     }
+    *p = '\0';
+    return s;
 }
 
-/* Comparator for sorting bg_job pointers by command name */
-static int cmp_bg_job(const void *a, const void *b) {
-    const bg_job *const *pa = a;
-    const bg_job *const *pb = b;
-    return strcmp((*pa)->command, (*pb)->command);
+/* A job the table cannot hold would never be reaped or reported: kill
+ * its process group rather than leave it running untracked */
+static void drop_untracked(pid_t pgid, const char *cmd) {
+    if (pgid > 0) kill(-pgid, SIGKILL);
+    printf("%s: could not track the job, killed\n", cmd);
+    fflush(stdout);
 }
 
-/* Print activities: list all processes spawned by shell that are running or stopped */
-void print_activities() {
-    /* First, update job list, removing any terminated processes */
-    bg_job *prev = NULL;
-    bg_job *cur = job_list;
-    while (cur) {
+/* Build and index a job for the stages pids[0..n) of process group 'pgid'.
+ * 'cmds' names each stage; when NULL every stage is shown as 'cmd'.
+ * Returns NULL (the group killed) if the job cannot be recorded.
+ */
+static bg_job *new_job(pid_t pgid, const pid_t *pids, const CmdNode *cmds, size_t n,
+                       const char *cmd, int stopped) {
+    char **names = arena_alloc(line_arena(), sizeof(char*) * (n ? n : 1));
+    bg_job *job = NULL;
+    for (size_t i = 0; names && i < n; ++i) {
+        /* a single stage keeps the full text, redirections included */
+        names[i] = (cmds && n > 1) ? stage_name(&cmds[i]) : (char *)cmd;
+        if (!names[i]) names = NULL;
+    }
+    if (names) job = jobs_new(pgid, pids, names, n, cmd, stopped);
+    if (job && jobs_add(job) != 0) {
+        jobs_free(job);
+        job = NULL;
+    }
+    if (!job) drop_untracked(pgid, cmd);
+    return job;
+}
+
+void add_stopped_job(pid_t pgid, const pid_t *pids, const CmdNode *cmds, size_t n,
+                     const char *cmd) {
+    bg_job *job = new_job(pgid, pids, cmds, n, cmd, 1);
+    if (!job) return;
+    printf("[%d] Stopped %s\n", job->job_id, job->command);
+    fflush(stdout);
+}
+
+/* Apply one waitpid() result to stage 'i' of 'job'. Once every stage is
+ * gone the job moves to the notice queue; like any pipeline, its exit
+ * status is that of its last stage.
+ */
+static void job_update(bg_job *job, size_t i, int status) {
+    bg_stage *st = &job->stages[i];
+    if (WIFSTOPPED(status)) {
+        st->stopped = 1;
+        job->stopped = 1;
+        return;
+    }
+    if (WIFCONTINUED(status)) {
+        st->stopped = 0;
+        job->stopped = 0;
+        for (size_t k = 0; k < job->nstages; ++k)
+            if (job->stages[k].pid > 0 && job->stages[k].stopped) job->stopped = 1;
+        return;
+    }
+    if (i == job->nstages - 1) job->status = status;
+    jobs_stage_done(job, i);
+    if (job->nlive > 0) return;
+
+    jobs_remove(job);
+    if (job->on_done) job->on_done(job->owner, job->status);
+    if (job->quiet) {
+        jobs_free(job);
+        return;
+    }
+    if (done_tail) done_tail->next = job; else done_head = job;
+    done_tail = job;
+}
+
+/* Collect every pending child state change with waitpid(-1) and route it
+ * to the foreground pipeline or to the owning job. Called whenever the
+ * SIGCHLD self-pipe is readable and at each safe point before a prompt.
+ */
+void reap_children(void) {
+    if (sigchld_pipe[0] >= 0) drain_sigchld_pipe();
+    while (1) {
         int status;
-        pid_t res = waitpid(cur->pid, &status, WNOHANG | WUNTRACED | WCONTINUED);
-        if (res == 0) {
-            /* still running or stopped; leave it */
-            prev = cur;
-            cur = cur->next;
-            continue;
-        } else if (res == -1) {
-            /* error - assume process gone, remove it */
-            bg_job *tmp = cur;
-            if (prev) prev->next = cur->next; else job_list = cur->next;
-            cur = cur->next;
-            free(tmp->command); free(tmp);
-            continue;
+        pid_t w = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED);
+        if (w <= 0) break;
+        if (fg_wait_update(w, status)) continue;
+        size_t stage;
+        bg_job *job = jobs_find_pid(w, &stage);
+        if (job) job_update(job, stage, status);
+    }
+}
+
+/* Descriptor that becomes readable when a child changes state, or -1 */
+int exec_sigchld_fd(void) {
+    return sigchld_pipe[0];
+}
+
+int check_background_jobs(void) {
+    reap_children();
+    queue_schedule();
+    int printed = 0;
+    while (done_head) {
+        bg_job *job = done_head;
+        done_head = job->next;
+        if (!done_head) done_tail = NULL;
+        /* Print completion status */
+        int status = job->status;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("\n%s with pid %d exited normally\n", job->command, job->pid);
         } else {
-            /* process changed state or exited; if exited, remove; if stopped, keep and mark */
-            if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                bg_job *tmp = cur;
-                if (prev) prev->next = cur->next; else job_list = cur->next;
-                cur = cur->next;
-                free(tmp->command); free(tmp);
-                continue;
-            } else {
-                prev = cur;
-                cur = cur->next;
-                continue;
-            }
+            printf("\n%s with pid %d exited abnormally\n", job->command, job->pid);
         }
+        jobs_free(job);
+        printed++;
     }
-
-    /* Collect remaining jobs into array for sorting */
-    size_t cap = 8, n = 0;
-    bg_job **arr = malloc(sizeof(bg_job*) * cap);
-    bg_job *it = job_list;
-    while (it) {
-        if (n + 1 >= cap) { cap *= 2; arr = realloc(arr, sizeof(bg_job*) * cap); }
-        arr[n++] = it;
-        it = it->next;
+    if (printed) {
+        printf("\n");
+        fflush(stdout);
     }
-    /* Sort by command name lexicographically */
-    qsort(arr, n, sizeof(bg_job*), cmp_bg_job);
+    return printed;
+}
 
-    /* Print each as: [pid] : command_name - State */
-    for (size_t i = 0; i < n; ++i) {
-        const char *state = arr[i]->stopped ? "Stopped" : "Running";
-        printf("[%d] : %s - %s\n", arr[i]->pid, arr[i]->command, state);
+/* Print one 'activities' line: [pid] : command_name - State */
+static void print_activity(const bg_stage *st, void *arg) {
+    (void)arg;
+    printf("[%d] : %s - %s\n", st->pid, st->name, st->stopped ? "Stopped" : "Running");
+}
+
+/* Print activities: list all processes spawned by shell that are running or stopped */
+void print_activities() {
+    /* First, pick up any state changes; finished jobs leave the list */
+    reap_children();
+
+    /* The job table keeps live stages ordered by command name */
+    jobs_foreach_stage(print_activity, NULL);
+}
+
+static void free_done_jobs(void) {
+    while (done_head) {
+        bg_job *tmp = done_head;
+        done_head = tmp->next;
+        jobs_free(tmp);
     }
-    free(arr);
+    done_tail = NULL;
 }
 
 void kill_all_children(void) {
     bg_job *cur = job_list;
     while (cur) {
-        kill(cur->pid, SIGKILL);
+        kill(-cur->pid, SIGKILL);
         cur = cur->next;
     }
-    /* free job list */
-    cur = job_list;
-    while (cur) {
-        bg_job *tmp = cur;
-        cur = cur->next;
-        free(tmp->command);
-        free(tmp);
-    }
-    job_list = NULL;
+    /* free job table and any unreported finished jobs */
+    jobs_clear();
+    free_done_jobs();
 }
 
 /* Cleanup function run at process exit: kill children and print logout */
 static void cleanup_on_exit(void) {
-    /* kill children and free list */
-    bg_job *cur = job_list;
+    /* kill children and free list; a script leaves its background jobs
+     * running */
+    bg_job *cur = interactive ? job_list : NULL;
     while (cur) {
-        kill(cur->pid, SIGKILL);
+        kill(-cur->pid, SIGKILL);
         cur = cur->next;
     }
-    /* free job list */
-    cur = job_list;
-    while (cur) {
-        bg_job *tmp = cur;
-        cur = cur->next;
-        free(tmp->command);
-        free(tmp);
-    }
-    job_list = NULL;
+    /* free job table and any unreported finished jobs */
+    jobs_clear();
+    free_done_jobs();
     /* Only print logout if this is the original shell process */
-    if (getpid() == shell_pid) {
+    if (getpid() == shell_pid && interactive) {
         printf("\nlogout\n");
         fflush(stdout);
     }
 }
 
 void init_job_list() {
-    job_list = NULL;
-    next_job_id = 1;
+    jobs_clear();
     shell_pid = getpid();
     /* Install SIGINT handler so shell doesn't exit on Ctrl-C */
     struct sigaction sa;
@@ -820,207 +745,238 @@ void init_job_list() {
     sigemptyset(&sa2.sa_mask);
     sa2.sa_flags = SA_RESTART;
     sigaction(SIGTSTP, &sa2, NULL);
+    /* SIGCHLD wakes up waiters through the self-pipe (stops included) */
+    if (sigchld_pipe_open() == 0) {
+        struct sigaction sa3;
+        sa3.sa_handler = sigchld_handler;
+        sigemptyset(&sa3.sa_mask);
+        sa3.sa_flags = SA_RESTART;
+        sigaction(SIGCHLD, &sa3, NULL);
+    }
     /* Ensure cleanup_on_exit runs when shell exits (e.g., on EOF) */
     atexit(cleanup_on_exit);
 }
 
+void exec_set_interactive(int on) {
+    interactive = on;
+}
+
 void handle_eof_exit(void) {
     /* Rely on atexit-registered cleanup_on_exit to kill children and print logout */
     exit(0);
 }
 
-/* Helper: find job by job_id */
-bg_job *find_job_by_id(int id) {
-    bg_job *it = job_list;
-    while (it) {
-        if (it->job_id == id) return it;
-        it = it->next;
+static int builtin_ping(char **argv, size_t argc) {
+    if (argc != 3) {
+        printf("Invalid syntax!\n");
+        return 1;
+    }
+    char *endptr;
+    long pid = strtol(argv[1], &endptr, 10);
+    if (*endptr != '\0') {
+        printf("Invalid syntax!\n");
+        return 1;
+    }
+    long sig = strtol(argv[2], &endptr, 10);
+    if (*endptr != '\0') {
+        printf("Invalid syntax!\n");
+        return 1;
+    }
+    int actual_sig = (int)(sig % 32);
+    if (actual_sig <= 0) actual_sig += 32; /* map 0 to 32? keep positive */
+    if (kill((pid_t)pid, actual_sig) < 0) {
+        if (errno == ESRCH) printf("No such process found\n");
+        else perror("kill");
+        return 1;
     }
-    return NULL;
+    printf("Sent signal %ld to process with pid %ld\n", sig, pid);
+    return 0;
 }
 
-/* Helper: remove job from list and return it (not freeing) */
-bg_job *unlink_job(bg_job *job) {
-    bg_job *it = job_list, *prev = NULL;
-    while (it) {
-        if (it == job) {
-            if (prev) prev->next = it->next; else job_list = it->next;
-            it->next = NULL;
-            return it;
+/* fg returns the job's exit status (128+SIGTSTP if it stopped again) */
+static int builtin_fg_bg(char **argv, size_t argc) {
+    int is_fg = (strcmp(argv[0], "fg") == 0);
+    int job_num = -1;
+    if (argc == 1) {
+        /* pick most recent job */
+        if (!job_list) {
+            printf("No such job\n");
+            return 1;
         }
-        prev = it;
-        it = it->next;
+        job_num = job_list->job_id;
+    } else if (argc == 2) {
+        char *endptr;
+        long v = strtol(argv[1], &endptr, 10);
+        if (*endptr != '\0') { printf("No such job\n"); return 1; }
+        job_num = (int)v;
+    } else {
+        printf("Invalid syntax!\n");
+        return 1;
     }
-    return NULL;
-}
 
-/* Top-level execution function */
-int exec_run_line(const char *line) {
-    if (!line) return -1;
-    size_t ntoks = 0;
-    char **toks = tokenize_special(line, &ntoks);
-    if (!toks) return -1;
-
-    /* After tokenizing */
-    if (ntoks == 1 && strcmp(toks[0], "activities") == 0) {
-        print_activities();
-        free_tokens(toks);
-        return 0;
-    }
+    bg_job *job = jobs_find(job_num);
+    if (!job) { printf("No such job\n"); return 1; }
 
-    /* Handle built-in: ping */
-    if (ntoks >= 1 && strcmp(toks[0], "ping") == 0) {
-        if (ntoks != 3) {
-            printf("Invalid syntax!\n");
-            free_tokens(toks);
-            return 0;
+    if (is_fg) {
+        /* Bring to foreground */
+        /* If stopped, send SIGCONT */
+        if (job->stopped) {
+            if (kill(-job->pid, SIGCONT) < 0) perror("kill");
+            job->stopped = 0;
         }
-        char *endptr;
-        long pid = strtol(toks[1], &endptr, 10);
-        if (*endptr != '\0') {
-            printf("Invalid syntax!\n");
-            free_tokens(toks);
-            return 0;
+        pid_t *pids = arena_alloc(line_arena(), sizeof(pid_t) * (job->nstages ? job->nstages : 1));
+        if (!pids) return 1;
+        for (size_t i = 0; i < job->nstages; ++i) pids[i] = job->stages[i].pid;
+        /* Remove from job table and wait for every stage of the group */
+        jobs_remove(job);
+        printf("%s\n", job->command);
+        fflush(stdout);
+        fg_pgid = job->pid;
+        int status;
+        if (wait_foreground(pids, job->nstages, &job->status)) {
+            /* move back to background as stopped, keeping the stage names */
+            for (size_t i = 0; i < job->nstages; ++i) {
+                if (job->stages[i].pid > 0 && pids[i] < 0) job->nlive--;
+                job->stages[i].pid = pids[i];
+                job->stages[i].stopped = 1;
+            }
+            job->stopped = 1;
+            status = 128 + SIGTSTP;
+            if (jobs_add(job) != 0) {
+                drop_untracked(job->pid, job->command);
+                if (job->on_done) job->on_done(job->owner, SIGKILL);
+                jobs_free(job);
+            } else {
+                printf("[%d] Stopped %s\n", job->job_id, job->command);
+                fflush(stdout);
+            }
+        } else {
+            status = exit_code(job->status);
+            if (job->on_done) job->on_done(job->owner, job->status);
+            jobs_free(job);
         }
-        long sig = strtol(toks[2], &endptr, 10);
-        if (*endptr != '\0') {
-            printf("Invalid syntax!\n");
-            free_tokens(toks);
-            return 0;
+        fg_pgid = 0;
+        return status;
+    } else {
+        /* bg: resume stopped job in background */
+        if (!job->stopped) {
+            printf("Job already running\n");
+            return 1;
         }
-        int actual_sig = (int)(sig % 32);
-        if (actual_sig <= 0) actual_sig += 32; /* map 0 to 32? keep positive */
-        if (kill((pid_t)pid, actual_sig) < 0) {
-            if (errno == ESRCH) printf("No such process found\n");
+        if (kill(-job->pid, SIGCONT) < 0) {
+            if (errno == ESRCH) printf("No such job\n");
             else perror("kill");
-        } else {
-            printf("Sent signal %ld to process with pid %ld\n", sig, pid);
+            return 1;
         }
-        free_tokens(toks);
-        return 0;
+        job->stopped = 0;
+        printf("[%d] %s &\n", job->job_id, job->command);
     }
+    return 0;
+}
 
-    /* Handle fg/bg builtins */
-    if (ntoks >= 1 && (strcmp(toks[0], "fg") == 0 || strcmp(toks[0], "bg") == 0)) {
-        int is_fg = (strcmp(toks[0], "fg") == 0);
-        int job_num = -1;
-        if (ntoks == 1) {
-            /* pick most recent job */
-            if (!job_list) {
-                printf("No such job\n");
-                free_tokens(toks);
-                return 0;
-            }
-            job_num = job_list->job_id;
-        } else if (ntoks == 2) {
-            char *endptr;
-            long v = strtol(toks[1], &endptr, 10);
-            if (*endptr != '\0') { printf("No such job\n"); free_tokens(toks); return 0; }
-            job_num = (int)v;
-        } else {
-            printf("Invalid syntax!\n"); free_tokens(toks); return 0;
+static int builtin_hash(char **argv, size_t argc) {
+    if (argc == 1) {
+        pathcache_validate();
+        pathcache_print();
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        pathcache_clear();
+        return 0;
+    }
+    int ret = 0;
+    for (size_t i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            printf("hash: Invalid Syntax!\n");
+            return 1;
         }
-
-        bg_job *job = find_job_by_id(job_num);
-        if (!job) { printf("No such job\n"); free_tokens(toks); return 0; }
-
-        if (is_fg) {
-            /* Bring to foreground */
-            /* If stopped, send SIGCONT */
-            if (job->stopped) {
-                if (kill(job->pid, SIGCONT) < 0) perror("kill");
-                job->stopped = 0;
-            }
-            /* Remove from job list and wait */
-            bg_job *uj = unlink_job(job);
-            if (!uj) { printf("No such job\n"); free_tokens(toks); return 0; }
-            printf("%s\n", uj->command);
-            fflush(stdout);
-            /* Wait for process group */
-            fg_pgid = uj->pid;
-            int st; pid_t w = waitpid(-uj->pid, &st, WUNTRACED);
-            if (w > 0 && WIFSTOPPED(st)) {
-                /* move back to background as stopped */
-                add_stopped_job(uj->pid, uj->command);
-            }
-            fg_pgid = 0;
-            free(uj->command); free(uj);
-            free_tokens(toks);
-            return 0;
-        } else {
-            /* bg: resume stopped job in background */
-            if (!job->stopped) {
-                printf("Job already running\n"); free_tokens(toks); return 0;
-            }
-            if (kill(job->pid, SIGCONT) < 0) {
-                if (errno == ESRCH) printf("No such job\n");
-                else perror("kill");
-            } else {
-                job->stopped = 0;
-                printf("[%d] %s &\n", job->job_id, job->command);
-            }
-            free_tokens(toks);
-            return 0;
+        if (pathcache_add(argv[i]) != 0) {
+            printf("hash: %s: not found\n", argv[i]);
+            ret = 1;
         }
     }
+    return ret;
+}
 
-    /* Process all commands in sequence */
-    size_t start = 0;
-    while (start < ntoks) {
-        /* Find next ';' or end */
-        size_t end = start;
-        while (end < ntoks && strcmp(toks[end], ";") != 0) end++;
-        
-        /* Check if command ends with & */
-        int is_background = 0;
-        if (end > start) {
-            size_t last = end - 1;
-            /* Handle case where command might end with & */
-            if (strcmp(toks[last], "&") == 0) {
-                is_background = 1;
-                end = last; /* Don't include & in command building */
-            }
-        }
-        
-        /* Build and run this command group */
-        char *cmd = malloc(strlen(line) + 1);
-        cmd[0] = '\0';
-        
-        for (size_t i = start; i < end; i++) {
-            strcat(cmd, toks[i]);
-            if (i < end - 1) strcat(cmd, " ");
+/* Run a builtin atomic in the current process, storing its exit status
+ * (0, or nonzero after it printed an error) in *status.
+ * Returns 1 if argv[0] named a builtin (and it ran), 0 otherwise.
+ */
+static int run_builtin(const CmdNode *c, int *status) {
+    char **argv = c->argv;
+    const char *name = argv[0];
+    if (strcmp(name, "hop") == 0) {
+        *status = do_hop(argv) < 0;
+    } else if (strcmp(name, "reveal") == 0) {
+        *status = do_reveal(argv) < 0;
+    } else if (strcmp(name, "log") == 0) {
+        *status = do_log(argv);
+    } else if (strcmp(name, "activities") == 0) {
+        print_activities();
+        *status = 0;
+    } else if (strcmp(name, "ping") == 0) {
+        *status = builtin_ping(argv, c->argc);
+    } else if (strcmp(name, "fg") == 0 || strcmp(name, "bg") == 0) {
+        *status = builtin_fg_bg(argv, c->argc);
+    } else if (strcmp(name, "hash") == 0) {
+        *status = builtin_hash(argv, c->argc);
+    } else if (strcmp(name, "queue") == 0) {
+        *status = builtin_queue(argv, c->argc);
+    } else if (strcmp(name, "parallel") == 0) {
+        /* only ever runs as a forked stage: report the jobs' outcome */
+        int st = builtin_parallel(argv, c->argc);
+        fflush(stdout);
+        _exit(st);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Execute an already parsed line: each command group in sequence */
+int exec_run_parsed(const CmdLine *cl) {
+    if (!cl) return -1;
+    /* one stat per PATH directory keeps cached command paths honest */
+    pathcache_validate();
+    for (size_t gi = 0; gi < cl->ngroups; ++gi) {
+        const CmdGroup *g = &cl->groups[gi];
+        const CmdNode *first = &g->cmds[0];
+
+        /* A lone foreground builtin without redirections runs in the shell
+         * so that hop, fg, bg etc. affect the shell itself.
+         */
+        if (!g->background && g->ncmds == 1 && !first->infile && !first->outfile &&
+            is_shell_builtin(first->argv[0])) {
+            run_builtin(first, &last_status);
+            continue;
         }
-        
-        /* Build pipeline for this command */
-        CmdNode *cmds = NULL;
-        size_t ncmds = 0;
-        int r = build_pipeline_from_tokens(toks + start, end - start, &cmds, &ncmds);
-        
-        if (r == 0 && ncmds > 0) {
-            if (is_background) {
-                pid_t pid = fork();
-                if (pid == 0) {
-                    /* Child */
-                    setpgid(0, 0); /* Set new process group */
-                    close(STDIN_FILENO); /* Background processes can't read from terminal */
-                    run_cmd_pipeline(cmds, ncmds, cmd);
-                    exit(0);
-                } else if (pid > 0) {
-                    /* Parent */
-                    setpgid(pid, pid); /* Ensure child is in its own group */
-                    add_background_job(pid, cmd);
-                }
-            } else {
-                run_cmd_pipeline(cmds, ncmds, cmd);
+
+        if (g->background) {
+            bg_job *job = run_background_pipeline(g);
+            last_status = job ? 0 : 127;
+            if (job) {
+                printf("[%d] %d\n", job->job_id, job->pid);
+                fflush(stdout);
             }
-            for (size_t i = 0; i < ncmds; ++i) free_cmdnode(&cmds[i]);
-            free(cmds);
+        } else {
+            run_cmd_pipeline(g->cmds, g->ncmds, g->text);
         }
-        
-        free(cmd);
-        start = is_background ? end + 2 : end + 1;  /* Skip the semicolon/& */
     }
-
-    free_tokens(toks);
     return 0;
 }
+
+/* Top-level execution function for an unparsed line (log execute) */
+int exec_run_line(const char *line) {
+    if (!line) return -1;
+    /* nested inside another line's execution: give back only our part */
+    Arena *arena = line_arena();
+    ArenaMark mark = arena_mark(arena);
+    CmdLine *cl = parse_command_line(arena, line);
+    if (!cl) {
+        printf("Invalid Syntax!\n");
+        return -1;
+    }
+    int r = exec_run_parsed(cl);
+    arena_rewind(arena, mark);
+    return r;
+}
@@ -0,0 +1,845 @@
+#define _GNU_SOURCE
+#include "frecency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Total rank past which every entry is aged by 0.9 */
+#define FRECENCY_RANK_MAX 1000000.0
+/* Most directories kept; the lowest ranked go first */
+#define FRECENCY_MAX_DIRS 200000
+/* Fold the log into the database once it is this large (~4000 visits) */
+#define LOG_COMPACT_BYTES (256 * 1024)
+/* Matches a keyword lookup ranks per round; the best one still on disk
+ * wins, and a round where all are gone is followed by another */
+#define LOOKUP_TOP 8
+#define LOOKUP_ROUNDS 8
+
+static const char *DB_FILENAME = ".osh_dirs";
+static const char *LOG_FILENAME = ".osh_dirs.log";
+static const char *LOCK_FILENAME = ".osh_dirs.lock";
+
+static const char DB_MAGIC[8] = { 'O', 'S', 'H', 'D', 'I', 'R', 'S', '1' };
+
+/* ~/.osh_dirs: DbHeader, DbRec[count], uint32_t table[table_cap] (record
+ * index + 1, 0 = empty), TriSlot tris[tri_cap], uint32_t posts[post_len],
+ * paths (NUL-terminated), bases (lowercased last components, each followed
+ * by a NUL). Records are sorted by rank, highest first, and the bases are
+ * in record order. */
+typedef struct {
+    char magic[8];
+    uint32_t count;
+    uint32_t table_cap;   /* power of two, or 0 when empty */
+    uint32_t paths_len;
+    uint32_t bases_len;
+    uint32_t tri_cap;     /* power of two, or 0 when empty */
+    uint32_t post_len;
+} DbHeader;
+
+/* Trigram of a lowercased base -> ascending record indexes holding it,
+ * posts[off..off+len); key 0 = empty slot */
+typedef struct {
+    uint32_t key;         /* the three bytes, big-endian */
+    uint32_t off;
+    uint32_t len;
+} TriSlot;
+
+typedef struct {
+    uint32_t path_off;
+    uint32_t base_off;
+    uint16_t path_len;
+    uint16_t base_len;
+    float rank;
+    int64_t last;         /* seconds since the epoch */
+} DbRec;
+
+/* Visits read from the log since the database was written */
+typedef struct {
+    char *path;           /* NULL => empty slot */
+    uint32_t hash;
+    uint16_t len;
+    float visits;
+    int64_t last;
+    long rec;             /* record in the database, or -1 if new */
+    int gone;             /* no longer a directory */
+} Visit;
+
+static char *db_path = NULL, *log_path = NULL, *lock_path = NULL;
+static int lock_fd = -1;
+static int log_fd = -1;           /* O_APPEND */
+static int log_rfd = -1;          /* reading side, identifies the log read */
+static off_t log_off = 0;         /* end of the last complete line read */
+static pid_t db_pid = 0;          /* forked children never compact */
+static int db_opened = 0;
+
+static char *map_base = NULL;
+static size_t map_len = 0;
+static const DbHeader *hdr = NULL;
+static const DbRec *recs = NULL;
+static const uint32_t *table = NULL;
+static const TriSlot *tris = NULL;
+static const uint32_t *posts = NULL;
+static const char *paths = NULL, *bases = NULL;
+
+static Visit *visits = NULL;      /* open addressing, linear probing */
+static size_t visits_cap = 0;     /* power of two */
+static size_t visits_count = 0;
+/* Bit per database record that also has visits in the overlay, and per
+ * record found gone by a lookup (dropped at the next compaction) */
+static unsigned char *touched = NULL;
+static unsigned char *gone = NULL;
+
+#define BIT_TEST(map, i) ((map) && ((map)[(i) / 8] >> ((i) % 8) & 1))
+#define BIT_SET(map, i) ((map)[(i) / 8] |= (unsigned char)(1u << ((i) % 8)))
+
+static char *join_path_home(const char *name) {
+    const char *home = getenv("HOME");
+    if (!home) return NULL;
+    size_t n = strlen(home) + 1 + strlen(name) + 1;
+    char *p = malloc(n);
+    if (!p) return NULL;
+    snprintf(p, n, "%s/%s", home, name);
+    return p;
+}
+
+/* FNV-1a, 32-bit since it is stored in the file */
+static uint32_t hash_path(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static char ascii_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static uint32_t tri_key(const char *p) {
+    return (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 |
+           (unsigned char)p[2];
+}
+
+static uint32_t tri_hash(uint32_t key) {
+    return (key * 2654435761u) >> 8;
+}
+
+/* Last component of path[0..len) */
+static size_t base_start(const char *path, size_t len) {
+    size_t i = len;
+    while (i > 0 && path[i - 1] != '/') i--;
+    return i;
+}
+
+static void db_lock(int op) {
+    if (lock_fd < 0) return;
+    while (flock(lock_fd, op) != 0 && errno == EINTR) {
+        /* retry */
+    }
+}
+
+static int same_file(int fd, const struct stat *st) {
+    struct stat fst;
+    return fd >= 0 && fstat(fd, &fst) == 0 && fst.st_dev == st->st_dev &&
+           fst.st_ino == st->st_ino;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* ----------- database file ----------- */
+
+static void db_unmap(void) {
+    if (map_base) munmap(map_base, map_len);
+    map_base = NULL;
+    map_len = 0;
+    hdr = NULL;
+    recs = NULL;
+    table = NULL;
+    tris = NULL;
+    posts = NULL;
+    paths = bases = NULL;
+}
+
+/* Map ~/.osh_dirs if it is there and well formed; otherwise the database
+ * is empty */
+static void db_map(void) {
+    db_unmap();
+    int fd = open(db_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DbHeader)) {
+        close(fd);
+        return;
+    }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return;
+    map_base = p;
+    map_len = (size_t)st.st_size;
+
+    const DbHeader *h = p;
+    uint64_t want = sizeof(DbHeader) + (uint64_t)h->count * sizeof(DbRec) +
+                    (uint64_t)h->table_cap * sizeof(uint32_t) +
+                    (uint64_t)h->tri_cap * sizeof(TriSlot) +
+                    (uint64_t)h->post_len * sizeof(uint32_t) + h->paths_len + h->bases_len;
+    int ok = memcmp(h->magic, DB_MAGIC, sizeof(DB_MAGIC)) == 0 && want == map_len &&
+             (h->table_cap & (h->table_cap - 1)) == 0 &&
+             (uint64_t)h->table_cap >= 2 * (uint64_t)h->count &&
+             (h->tri_cap & (h->tri_cap - 1)) == 0;
+    const DbRec *r = (const DbRec *)(h + 1);
+    const TriSlot *ts = (const TriSlot *)((const uint32_t *)(r + h->count) + h->table_cap);
+    const uint32_t *ps = (const uint32_t *)(ts + h->tri_cap);
+    const char *pp = (const char *)(ps + h->post_len);
+    const char *bp = pp + h->paths_len;
+    /* every offset must stay inside its pool, bases in ascending order */
+    uint32_t prev_end = 0;
+    for (uint32_t i = 0; ok && i < h->count; ++i) {
+        ok = (uint64_t)r[i].path_off + r[i].path_len < h->paths_len &&
+             pp[r[i].path_off + r[i].path_len] == '\0' &&
+             r[i].base_off >= prev_end &&
+             (uint64_t)r[i].base_off + r[i].base_len < h->bases_len &&
+             r[i].base_len <= r[i].path_len;
+        prev_end = r[i].base_off + r[i].base_len + 1;
+    }
+    if (!ok) {
+        db_unmap();
+        return;
+    }
+    hdr = h;
+    recs = r;
+    table = (const uint32_t *)(r + h->count);
+    tris = ts;
+    posts = ps;
+    paths = pp;
+    bases = bp;
+}
+
+/* Record of path[0..len) in the database, or -1 */
+static long db_find(const char *path, size_t len, uint32_t hash) {
+    if (!hdr || hdr->table_cap == 0) return -1;
+    uint32_t mask = hdr->table_cap - 1;
+    for (uint32_t j = hash & mask;; j = (j + 1) & mask) {
+        uint32_t v = table[j];
+        if (v == 0 || v > hdr->count) return -1;
+        const DbRec *r = &recs[v - 1];
+        if (r->path_len == len && memcmp(paths + r->path_off, path, len) == 0) return (long)v - 1;
+    }
+}
+
+/* Record whose base holds pool offset 'off' */
+static const DbRec *db_rec_at(uint32_t off) {
+    size_t lo = 0, hi = hdr->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (recs[mid].base_off <= off) lo = mid;
+        else hi = mid;
+    }
+    return &recs[lo];
+}
+
+/* Posting list of trigram 'key'; sets *len, NULL if no base holds it.
+ * Lists are bounds-checked here rather than when mapping. */
+static const uint32_t *db_postings(uint32_t key, uint32_t *len) {
+    *len = 0;
+    if (!hdr || hdr->tri_cap == 0) return NULL;
+    uint32_t mask = hdr->tri_cap - 1;
+    for (uint32_t j = tri_hash(key) & mask, n = 0; n < hdr->tri_cap; j = (j + 1) & mask, ++n) {
+        const TriSlot *t = &tris[j];
+        if (t->key == 0) return NULL;
+        if (t->key != key) continue;
+        if ((uint64_t)t->off + t->len > hdr->post_len) return NULL;
+        *len = t->len;
+        return posts + t->off;
+    }
+    return NULL;
+}
+
+/* ----------- visits overlay ----------- */
+
+static void visits_clear(void) {
+    for (size_t i = 0; i < visits_cap; ++i) free(visits[i].path);
+    free(visits);
+    visits = NULL;
+    visits_cap = 0;
+    visits_count = 0;
+    free(touched);
+    free(gone);
+    touched = NULL;
+    gone = NULL;
+}
+
+static Visit *visits_find(const char *path, size_t len, uint32_t hash) {
+    if (visits_count == 0) return NULL;
+    for (size_t j = hash & (visits_cap - 1); visits[j].path; j = (j + 1) & (visits_cap - 1)) {
+        Visit *v = &visits[j];
+        if (v->hash == hash && v->len == len && memcmp(v->path, path, len) == 0) return v;
+    }
+    return NULL;
+}
+
+static int visits_grow(void) {
+    size_t ncap = visits_cap ? visits_cap * 2 : 64;
+    Visit *nt = calloc(ncap, sizeof(Visit));
+    if (!nt) return -1;
+    for (size_t i = 0; i < visits_cap; ++i) {
+        if (!visits[i].path) continue;
+        size_t j = visits[i].hash & (ncap - 1);
+        while (nt[j].path) j = (j + 1) & (ncap - 1);
+        nt[j] = visits[i];
+    }
+    free(visits);
+    visits = nt;
+    visits_cap = ncap;
+    return 0;
+}
+
+static void visits_add(const char *path, size_t len, int64_t when) {
+    uint32_t hash = hash_path(path, len);
+    Visit *v = visits_find(path, len, hash);
+    if (!v) {
+        if ((visits_count + 1) * 2 > visits_cap && visits_grow() != 0) return;
+        char *copy = malloc(len + 1);
+        if (!copy) return;
+        memcpy(copy, path, len);
+        copy[len] = '\0';
+        size_t j = hash & (visits_cap - 1);
+        while (visits[j].path) j = (j + 1) & (visits_cap - 1);
+        v = &visits[j];
+        v->path = copy;
+        v->hash = hash;
+        v->len = (uint16_t)len;
+        v->visits = 0;
+        v->last = 0;
+        v->rec = db_find(path, len, hash);
+        visits_count++;
+        v->gone = 0;
+        if (v->rec >= 0) {
+            if (!touched) touched = calloc(hdr->count / 8 + 1, 1);
+            if (touched) BIT_SET(touched, v->rec);
+        }
+    }
+    v->visits += 1;
+    if (when > v->last) v->last = when;
+}
+
+/* ----------- log ----------- */
+
+/* Fold in the complete "<time> <path>\n" lines of buf[0..n); returns the
+ * bytes consumed */
+static size_t log_replay(const char *buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        const char *nl = memchr(buf + done, '\n', n - done);
+        if (!nl) break;   /* torn or still being written */
+        const char *line = buf + done;
+        size_t len = (size_t)(nl - line);
+        done += len + 1;
+        const char *sp = memchr(line, ' ', len);
+        if (!sp || sp + 1 >= nl || sp[1] != '/') continue;
+        int64_t when = strtoll(line, NULL, 10);
+        size_t plen = (size_t)(nl - sp - 1);
+        if (plen >= PATH_MAX || plen > UINT16_MAX) continue;
+        visits_add(sp + 1, plen, when);
+    }
+    return done;
+}
+
+/* Catch up with the log. When a compaction replaced it, the database was
+ * rewritten first: map the new one and start the overlay over. */
+static void db_sync(void) {
+    struct stat st;
+    if (stat(log_path, &st) != 0) {
+        if (log_rfd < 0) return;
+        st.st_ino = 0;
+    }
+    if (!same_file(log_rfd, &st)) {
+        if (log_rfd >= 0) close(log_rfd);
+        visits_clear();
+        log_off = 0;
+        db_map();
+        log_rfd = open(log_path, O_RDONLY | O_CLOEXEC);
+        if (log_rfd < 0) return;
+        if (fstat(log_rfd, &st) != 0) return;
+    }
+    if (st.st_size <= log_off) return;
+    size_t n = (size_t)(st.st_size - log_off);
+    char *buf = malloc(n);
+    if (!buf) return;
+    ssize_t got = pread(log_rfd, buf, n, log_off);
+    if (got > 0) log_off += (off_t)log_replay(buf, (size_t)got);
+    free(buf);
+}
+
+static int db_open(void) {
+    if (db_opened) return db_path ? 0 : -1;
+    db_opened = 1;
+    db_path = join_path_home(DB_FILENAME);
+    log_path = join_path_home(LOG_FILENAME);
+    lock_path = join_path_home(LOCK_FILENAME);
+    if (!db_path || !log_path || !lock_path) {
+        free(db_path);
+        free(log_path);
+        free(lock_path);
+        db_path = log_path = lock_path = NULL;
+        return -1;
+    }
+    lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    db_pid = getpid();
+    db_map();
+    db_sync();
+    return 0;
+}
+
+/* ----------- compaction ----------- */
+
+typedef struct {
+    const char *path;
+    uint16_t len;
+    float rank;
+    int64_t last;
+} MergeEnt;
+
+static int cmp_rank_desc(const void *a, const void *b) {
+    const MergeEnt *x = a, *y = b;
+    if (x->rank != y->rank) return x->rank < y->rank ? 1 : -1;
+    return (x->last < y->last) - (x->last > y->last);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Write ents[0..n), sorted by rank, as a database file at 'path' */
+static int db_write(const char *path, const MergeEnt *ents, size_t n) {
+    uint32_t cap = 0;
+    if (n > 0) {
+        cap = 64;
+        while (cap < n * 2) cap *= 2;
+    }
+    size_t paths_len = 0, bases_len = 0, npairs = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t bl = ents[i].len - base_start(ents[i].path, ents[i].len);
+        paths_len += ents[i].len + 1u;
+        bases_len += bl + 1u;
+        if (bl >= 3) npairs += bl - 2;
+    }
+    if (paths_len > UINT32_MAX || bases_len > UINT32_MAX || npairs > UINT32_MAX) return -1;
+
+    /* (trigram, record) pairs, sorted: the posting lists in order */
+    uint64_t *pairs = malloc((npairs ? npairs : 1) * sizeof(uint64_t));
+    if (!pairs) return -1;
+    size_t np = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t bs = base_start(ents[i].path, ents[i].len);
+        char low[3];
+        for (size_t k = bs; k + 2 < ents[i].len; ++k) {
+            low[0] = ascii_lower(ents[i].path[k]);
+            low[1] = ascii_lower(ents[i].path[k + 1]);
+            low[2] = ascii_lower(ents[i].path[k + 2]);
+            pairs[np++] = (uint64_t)tri_key(low) << 32 | (uint32_t)i;
+        }
+    }
+    qsort(pairs, np, sizeof(uint64_t), cmp_u64);
+    size_t ntri = 0, post_len = 0;
+    for (size_t k = 0; k < np; ++k) {
+        if (k > 0 && pairs[k] == pairs[k - 1]) continue;
+        post_len++;
+        if (k == 0 || pairs[k] >> 32 != pairs[k - 1] >> 32) ntri++;
+    }
+    uint32_t tri_cap = 0;
+    if (ntri > 0) {
+        tri_cap = 64;
+        while (tri_cap < ntri * 2) tri_cap *= 2;
+    }
+
+    size_t total = sizeof(DbHeader) + n * sizeof(DbRec) + cap * sizeof(uint32_t) +
+                   tri_cap * sizeof(TriSlot) + post_len * sizeof(uint32_t) +
+                   paths_len + bases_len;
+    char *buf = calloc(1, total);
+    if (!buf) {
+        free(pairs);
+        return -1;
+    }
+    DbHeader *h = (DbHeader *)buf;
+    memcpy(h->magic, DB_MAGIC, sizeof(DB_MAGIC));
+    h->count = (uint32_t)n;
+    h->table_cap = cap;
+    h->paths_len = (uint32_t)paths_len;
+    h->bases_len = (uint32_t)bases_len;
+    h->tri_cap = tri_cap;
+    h->post_len = (uint32_t)post_len;
+    DbRec *r = (DbRec *)(h + 1);
+    uint32_t *t = (uint32_t *)(r + n);
+    TriSlot *ts = (TriSlot *)(t + cap);
+    uint32_t *ps = (uint32_t *)(ts + tri_cap);
+    char *pp = (char *)(ps + post_len);
+    char *bp = pp + paths_len;
+    uint32_t poff = 0, boff = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const MergeEnt *e = &ents[i];
+        size_t bs = base_start(e->path, e->len);
+        r[i].path_off = poff;
+        r[i].path_len = e->len;
+        r[i].base_off = boff;
+        r[i].base_len = (uint16_t)(e->len - bs);
+        r[i].rank = e->rank;
+        r[i].last = e->last;
+        memcpy(pp + poff, e->path, e->len);
+        poff += e->len + 1u;
+        for (size_t k = bs; k < e->len; ++k) bp[boff++] = ascii_lower(e->path[k]);
+        boff++;
+        uint32_t j = hash_path(e->path, e->len) & (cap - 1);
+        while (t[j]) j = (j + 1) & (cap - 1);
+        t[j] = (uint32_t)i + 1;
+    }
+    uint32_t pos = 0;
+    TriSlot *cur = NULL;
+    for (size_t k = 0; k < np; ++k) {
+        if (k > 0 && pairs[k] == pairs[k - 1]) continue;
+        uint32_t key = (uint32_t)(pairs[k] >> 32);
+        if (!cur || cur->key != key) {
+            uint32_t j = tri_hash(key) & (tri_cap - 1);
+            while (ts[j].key) j = (j + 1) & (tri_cap - 1);
+            cur = &ts[j];
+            cur->key = key;
+            cur->off = pos;
+        }
+        cur->len++;
+        ps[pos++] = (uint32_t)pairs[k];
+    }
+    free(pairs);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int ok = fd >= 0 && write_all(fd, buf, total) == 0 && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    free(buf);
+    return ok ? 0 : -1;
+}
+
+/* Rename 'tmp' over 'dest', removing it on failure */
+static int replace_with(const char *tmp, const char *dest) {
+    if (rename(tmp, dest) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Merge the database and the log into a new database and start an empty
+ * log. The caller holds the lock exclusively. */
+static void db_compact_locked(void) {
+    db_sync();
+    size_t count = hdr ? hdr->count : 0;
+    MergeEnt *ents = malloc((count + visits_count + 1) * sizeof(MergeEnt));
+    if (!ents) return;
+    for (size_t i = 0; i < count; ++i) {
+        ents[i].path = paths + recs[i].path_off;
+        ents[i].len = recs[i].path_len;
+        /* directories found gone are dropped with rank 0 */
+        ents[i].rank = BIT_TEST(gone, i) ? 0 : recs[i].rank;
+        ents[i].last = recs[i].last;
+    }
+    size_t n = count;
+    for (size_t i = 0; i < visits_cap; ++i) {
+        const Visit *v = &visits[i];
+        if (!v->path || v->gone || (v->rec >= 0 && BIT_TEST(gone, v->rec))) continue;
+        MergeEnt *e = v->rec >= 0 ? &ents[v->rec] : &ents[n++];
+        if (v->rec < 0) {
+            e->path = v->path;
+            e->len = v->len;
+            e->rank = 0;
+            e->last = 0;
+        }
+        e->rank += v->visits;
+        if (v->last > e->last) e->last = v->last;
+    }
+
+    double total = 0;
+    for (size_t i = 0; i < n; ++i) total += ents[i].rank;
+    float age = total > FRECENCY_RANK_MAX ? 0.9f : 1.0f;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i) {
+        ents[i].rank *= age;
+        if (ents[i].rank >= 1.0f || (age == 1.0f && ents[i].rank > 0)) ents[kept++] = ents[i];
+    }
+    n = kept;
+    /* highest rank first, which lets lookups stop early */
+    qsort(ents, n, sizeof(MergeEnt), cmp_rank_desc);
+    if (n > FRECENCY_MAX_DIRS) n = FRECENCY_MAX_DIRS;
+
+    size_t plen = strlen(db_path);
+    char *tmp = malloc(plen + 32);
+    if (!tmp) {
+        free(ents);
+        return;
+    }
+    snprintf(tmp, plen + 32, "%s.%ld.tmp", db_path, (long)getpid());
+    int ok = db_write(tmp, ents, n) == 0 && replace_with(tmp, db_path) == 0;
+    if (!ok) unlink(tmp);
+    free(ents);
+    if (ok) {
+        /* the visits are in the database now: replace the log with an
+         * empty one, which makes every session remap */
+        snprintf(tmp, plen + 32, "%s.%ld.tmp", log_path, (long)getpid());
+        int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            close(fd);
+            replace_with(tmp, log_path);
+        }
+        db_sync();
+    }
+    free(tmp);
+}
+
+static void db_compact(void) {
+    if (getpid() != db_pid) return;
+    db_lock(LOCK_EX);
+    db_compact_locked();
+    db_lock(LOCK_UN);
+}
+
+/* ----------- public ----------- */
+
+void frecency_visit(const char *path) {
+    size_t len = strlen(path);
+    if (len == 0 || path[0] != '/' || len >= PATH_MAX || strchr(path, '\n')) return;
+    if (db_open() != 0) return;
+    char stackbuf[PATH_MAX + 32];
+    int n = snprintf(stackbuf, sizeof(stackbuf), "%lld %s\n", (long long)time(NULL), path);
+    if (n < 0 || (size_t)n >= sizeof(stackbuf)) return;
+
+    db_lock(LOCK_SH);
+    /* follow the log if a compaction replaced it */
+    struct stat st;
+    if (stat(log_path, &st) != 0 || !same_file(log_fd, &st)) {
+        if (log_fd >= 0) close(log_fd);
+        log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+    int r = log_fd >= 0 ? write_all(log_fd, stackbuf, (size_t)n) : -1;
+    off_t size = log_fd >= 0 && fstat(log_fd, &st) == 0 ? st.st_size : 0;
+    db_lock(LOCK_UN);
+    if (r == 0 && size > LOG_COMPACT_BYTES) db_compact();
+}
+
+/* Rank adjusted for the time since the last visit */
+static double score(double rank, int64_t last, time_t now) {
+    int64_t age = (int64_t)now - last;
+    if (age < 3600) return rank * 4;
+    if (age < 86400) return rank * 2;
+    if (age < 604800) return rank / 2;
+    return rank / 4;
+}
+
+/* Whether needle[0..nlen) occurs in the last component of path[0..len),
+ * ignoring case if 'icase' (the needle is then lowercase already) */
+static int base_matches(const char *path, size_t len, const char *needle, size_t nlen,
+                        int icase) {
+    size_t bs = base_start(path, len);
+    if (!icase) return memmem(path + bs, len - bs, needle, nlen) != NULL;
+    char low[PATH_MAX];
+    size_t bl = len - bs;
+    for (size_t k = 0; k < bl; ++k) low[k] = ascii_lower(path[bs + k]);
+    return memmem(low, bl, needle, nlen) != NULL;
+}
+
+/* The LOOKUP_TOP best matches, best first */
+typedef struct {
+    const char *path;
+    size_t len;
+    double score;
+    int64_t last;
+    long rec;             /* database record, or -1 */
+    Visit *visit;         /* overlay entry, or NULL */
+} Match;
+
+typedef struct {
+    Match top[LOOKUP_TOP];
+    size_t n;
+    time_t now;
+    const char *cwd;
+    size_t cwd_len;
+    const char *needle;   /* lowercased keyword */
+    const char *keyword;
+    size_t nlen;
+    int icase;
+} Matches;
+
+/* Higher score first, then the more recent visit, then the shorter path */
+static int match_better(const Match *a, const Match *b) {
+    if (a->score != b->score) return a->score > b->score;
+    if (a->last != b->last) return a->last > b->last;
+    return a->len < b->len;
+}
+
+static void consider(Matches *m, const char *path, size_t len, double rank, int64_t last,
+                     long rec, Visit *visit) {
+    if (m->cwd && m->cwd_len == len && memcmp(m->cwd, path, len) == 0) return;
+    Match c;
+    c.path = path;
+    c.len = len;
+    c.score = score(rank, last, m->now);
+    c.last = last;
+    c.rec = rec;
+    c.visit = visit;
+    if (m->n == LOOKUP_TOP && !match_better(&c, &m->top[LOOKUP_TOP - 1])) return;
+    size_t i = m->n < LOOKUP_TOP ? m->n++ : LOOKUP_TOP - 1;
+    while (i > 0 && match_better(&c, &m->top[i - 1])) {
+        m->top[i] = m->top[i - 1];
+        i--;
+    }
+    m->top[i] = c;
+}
+
+/* Whether database record i matches the keyword */
+static int rec_matches(const Matches *m, const DbRec *r) {
+    if (m->icase) return memmem(bases + r->base_off, r->base_len, m->needle, m->nlen) != NULL;
+    return base_matches(paths + r->path_off, r->path_len, m->keyword, m->nlen, 0);
+}
+
+/* Offer database record i. Returns 0 once no later record can make the
+ * list: records are sorted by rank, and age multiplies it by 4 at most. */
+static int consider_rec(Matches *m, uint32_t i, int verify) {
+    const DbRec *r = &recs[i];
+    if (m->n == LOOKUP_TOP && (double)r->rank * 4 < m->top[LOOKUP_TOP - 1].score) return 0;
+    /* overlay records are offered with their new visits separately */
+    if (BIT_TEST(touched, i) || BIT_TEST(gone, i)) return 1;
+    if (verify && !rec_matches(m, r)) return 1;
+    consider(m, paths + r->path_off, r->path_len, r->rank, r->last, (long)i, NULL);
+    return 1;
+}
+
+static void scan_database(Matches *m) {
+    if (!hdr || hdr->count == 0) return;
+    if (m->nlen >= 3) {
+        /* walk the shortest posting list among the keyword's trigrams */
+        const uint32_t *list = NULL;
+        uint32_t len = 0;
+        for (size_t k = 0; k + 2 < m->nlen; ++k) {
+            uint32_t l;
+            const uint32_t *p = db_postings(tri_key(m->needle + k), &l);
+            if (!p) return;
+            if (!list || l < len) {
+                list = p;
+                len = l;
+            }
+        }
+        for (uint32_t k = 0; k < len; ++k) {
+            if (list[k] >= hdr->count) return;
+            if (!consider_rec(m, list[k], m->nlen > 3 || !m->icase)) return;
+        }
+        return;
+    }
+    /* one or two bytes: a pass over the bases */
+    const char *p = bases, *end = bases + hdr->bases_len;
+    const char *hit;
+    while (p < end && (hit = memmem(p, (size_t)(end - p), m->needle, m->nlen)) != NULL) {
+        uint32_t i = (uint32_t)(db_rec_at((uint32_t)(hit - bases)) - recs);
+        p = bases + recs[i].base_off + recs[i].base_len + 1;
+        if (!consider_rec(m, i, !m->icase)) return;
+    }
+}
+
+static void scan_overlay(Matches *m) {
+    for (size_t i = 0; i < visits_cap; ++i) {
+        Visit *v = &visits[i];
+        if (!v->path || v->gone) continue;
+        if (v->rec >= 0) {
+            const DbRec *r = &recs[v->rec];
+            if (BIT_TEST(gone, v->rec) || !rec_matches(m, r)) continue;
+            consider(m, v->path, v->len, r->rank + v->visits, v->last > r->last ? v->last : r->last,
+                     v->rec, v);
+        } else {
+            if (!base_matches(v->path, v->len, m->icase ? m->needle : m->keyword, m->nlen,
+                              m->icase)) continue;
+            consider(m, v->path, v->len, v->visits, v->last, -1, v);
+        }
+    }
+}
+
+int frecency_lookup(const char *keyword, const char *cwd, char *out, size_t outsz) {
+    size_t nlen = strlen(keyword);
+    if (nlen == 0 || nlen >= PATH_MAX || db_open() != 0) return -1;
+    db_sync();
+
+    /* smart case: an all-lowercase keyword matches any case */
+    char needle[PATH_MAX];
+    Matches m;
+    m.icase = 1;
+    for (size_t k = 0; k < nlen; ++k) {
+        if (keyword[k] >= 'A' && keyword[k] <= 'Z') m.icase = 0;
+        needle[k] = ascii_lower(keyword[k]);
+    }
+    m.now = time(NULL);
+    m.cwd = cwd;
+    m.cwd_len = cwd ? strlen(cwd) : 0;
+    m.needle = needle;
+    m.keyword = keyword;
+    m.nlen = nlen;
+
+    for (int round = 0; round < LOOKUP_ROUNDS; ++round) {
+        m.n = 0;
+        scan_overlay(&m);
+        scan_database(&m);
+        if (m.n == 0) return -1;
+        /* the best that still exists; the rest are skipped from now on */
+        for (size_t i = 0; i < m.n; ++i) {
+            const Match *c = &m.top[i];
+            if (c->len + 1 > outsz) continue;
+            memcpy(out, c->path, c->len);
+            out[c->len] = '\0';
+            struct stat st;
+            if (stat(out, &st) == 0 && S_ISDIR(st.st_mode)) return 0;
+            if (c->visit) c->visit->gone = 1;
+            if (c->rec >= 0) {
+                if (!gone) gone = calloc(hdr->count / 8 + 1, 1);
+                if (!gone) return -1;
+                BIT_SET(gone, c->rec);
+            }
+        }
+    }
+    return -1;
+}
+
+void frecency_cleanup(void) {
+    if (!db_opened) return;
+    visits_clear();
+    db_unmap();
+    if (log_fd >= 0) close(log_fd);
+    if (log_rfd >= 0) close(log_rfd);
+    if (lock_fd >= 0) close(lock_fd);
+    log_fd = log_rfd = lock_fd = -1;
+    log_off = 0;
+    free(db_path);
+    free(log_path);
+    free(lock_path);
+    db_path = log_path = lock_path = NULL;
+    db_opened = 0;
+}
@@ -0,0 +1,1102 @@
+#define _POSIX_C_SOURCE 200809L
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+/* Default number of entries kept; OSH_HISTSIZE or 'log size N' change it */
+#ifndef HIST_MAX
+#define HIST_MAX 15
+#endif
+
+/* Compact once the journal holds this many records per live entry */
+#define COMPACT_FACTOR 4
+
+/* History persistence file name within $HOME */
+static const char *HIST_FILENAME = ".osh_history";
+/* Lock file coordinating the sessions that share it */
+static const char *LOCK_FILENAME = ".osh_history.lock";
+
+typedef struct {
+    const char *text;  /* into the journal mapping unless owned; not NUL-terminated */
+    size_t len;
+    size_t hash;
+    size_t seq;        /* position in the ring */
+    uint32_t tid;      /* id in the trigram index */
+    int owned;
+    int cwd_owned;
+    HistMeta meta;     /* latest run and totals; meta.runs == 0 if unknown */
+} HistEntry;
+
+/* Metadata records are "\x1f<tags>\x1f<command>\n"; tags are ';'-separated
+ * key=value pairs with the working directory (c=) last */
+#define TAG_MARK '\x1f'
+
+/* The command being run: recorded when it starts, written out with its
+ * metadata once it finishes */
+static struct {
+    char *line;
+    long long start;
+    struct timespec t0;
+    char *cwd;
+} pending;
+
+/*
+ * In-memory history: a ring of entry pointers indexed by sequence number
+ * (seq & (ring_cap - 1)), oldest at ring_head, newest at ring_tail - 1.
+ * Moving an entry to the newest slot leaves a hole (NULL) behind; holes are
+ * skipped on eviction and squeezed out once the ring fills up, so recording
+ * is amortized O(1). A hash index maps command text to its entry.
+ *
+ * None of this is built at startup. The journal is only mapped; the ring
+ * and index are filled on first access, with entries loaded from the
+ * journal pointing into the mapping instead of being copied.
+ */
+static HistEntry **ring = NULL;
+static size_t ring_cap = 0;          /* power of two */
+static size_t ring_head = 0, ring_tail = 0;
+static size_t history_len = 0;       /* live entries */
+static size_t hist_max = HIST_MAX;
+static int loaded = 0;
+
+/* text -> entry, open addressing with linear probing */
+static HistEntry **index_slots = NULL;
+static size_t index_cap = 0;         /* power of two */
+static size_t index_used = 0;        /* live + deleted slots */
+static HistEntry index_deleted;      /* tombstone marker */
+#define INDEX_DELETED (&index_deleted)
+
+/*
+ * The journal is shared by every session of the user. Appends hold a
+ * shared flock() on a separate lock file (the journal itself is replaced
+ * by compaction), compaction holds it exclusively. Once loaded, a session
+ * merges the records other sessions appended by reading the file from
+ * read_off on, and starts over only when a compaction replaced the file.
+ */
+static char *journal_path = NULL;
+static char *lock_path = NULL;
+static int journal_fd = -1;          /* O_APPEND */
+static int journal_rfd = -1;         /* reading side, tracks the file loaded */
+static int lock_fd = -1;
+static off_t read_off = 0;           /* end of the last record read */
+/* records in the file (live or stale) once loaded; before that, only the
+ * records appended by this session */
+static size_t journal_records = 0;
+/* process that owns the journal; forked children must not compact it */
+static pid_t journal_pid = 0;
+
+/* Read-only mapping of the journal. Loaded entries point into it, so it
+ * stays mapped (even across a compaction's rename) until they are freed. */
+static char *map_base = NULL;
+static size_t map_len = 0;
+
+/* Newest record while not loaded, for the consecutive-duplicate rule */
+static const char *last_text = NULL;
+static size_t last_len = 0;
+static char *last_owned = NULL;
+
+static char *join_path_home(const char *name) {
+    const char *home = getenv("HOME");
+    if (!home) return NULL;
+    size_t n = strlen(home) + 1 + strlen(name) + 1;
+    char *p = malloc(n);
+    if (!p) return NULL;
+    snprintf(p, n, "%s/%s", home, name);
+    return p;
+}
+
+/* FNV-1a */
+static size_t hash_text(const char *s, size_t n) {
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int index_resize(size_t ncap) {
+    HistEntry **t = calloc(ncap, sizeof(HistEntry*));
+    if (!t) return -1;
+    for (size_t i = 0; i < index_cap; ++i) {
+        HistEntry *e = index_slots[i];
+        if (!e || e == INDEX_DELETED) continue;
+        size_t h = e->hash & (ncap - 1);
+        while (t[h]) h = (h + 1) & (ncap - 1);
+        t[h] = e;
+    }
+    free(index_slots);
+    index_slots = t;
+    index_cap = ncap;
+    index_used = history_len;
+    return 0;
+}
+
+/* Slot holding 'text' (or NULL) */
+static HistEntry **index_find(const char *text, size_t len, size_t hash) {
+    if (index_cap == 0) return NULL;
+    size_t h = hash & (index_cap - 1);
+    while (index_slots[h]) {
+        HistEntry *e = index_slots[h];
+        if (e != INDEX_DELETED && e->hash == hash && e->len == len &&
+            memcmp(e->text, text, len) == 0) {
+            return &index_slots[h];
+        }
+        h = (h + 1) & (index_cap - 1);
+    }
+    return NULL;
+}
+
+static int index_insert(HistEntry *e) {
+    if ((index_used + 1) * 2 > index_cap) {
+        /* mostly tombstones: rehash in place instead of doubling */
+        size_t ncap = index_cap ? index_cap : 64;
+        while ((history_len + 1) * 4 > ncap) ncap *= 2;
+        if (index_resize(ncap) != 0) return -1;
+    }
+    size_t h = e->hash & (index_cap - 1);
+    while (index_slots[h] && index_slots[h] != INDEX_DELETED) h = (h + 1) & (index_cap - 1);
+    if (!index_slots[h]) index_used++;
+    index_slots[h] = e;
+    return 0;
+}
+
+static void index_remove(HistEntry *e) {
+    HistEntry **slot = index_find(e->text, e->len, e->hash);
+    if (slot) *slot = INDEX_DELETED;
+}
+
+/*
+ * Trigram index for substring search: every distinct 3-byte sequence of an
+ * entry's text maps to a posting list of entry ids, ascending. Ids index
+ * tri_ids; a dropped entry only clears its id there, and the lists are
+ * rebuilt once dead ids outnumber live ones. Built on the first search,
+ * then maintained as entries come and go.
+ */
+typedef struct {
+    uint32_t key;      /* trigram | TRI_USED, 0 when free */
+    uint32_t n, cap;
+    uint32_t *ids;
+} TriList;
+
+#define TRI_USED  (1u << 24)
+#define TRI_NONE  UINT32_MAX
+
+static TriList *tri_slots = NULL;
+static size_t tri_cap = 0;           /* power of two */
+static size_t tri_used = 0;
+static HistEntry **tri_ids = NULL;   /* id -> entry, NULL once dropped */
+static size_t tri_nids = 0, tri_idcap = 0;
+static size_t tri_live = 0;
+static int tri_built = 0;
+
+static uint32_t tri_key(const char *p) {
+    return ((uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 |
+            (uint32_t)(unsigned char)p[2]) | TRI_USED;
+}
+
+static size_t tri_hash(uint32_t key) {
+    return (size_t)(key * 2654435761u);
+}
+
+static TriList *tri_find(uint32_t key) {
+    if (tri_cap == 0) return NULL;
+    size_t h = tri_hash(key) & (tri_cap - 1);
+    while (tri_slots[h].key) {
+        if (tri_slots[h].key == key) return &tri_slots[h];
+        h = (h + 1) & (tri_cap - 1);
+    }
+    return NULL;
+}
+
+static TriList *tri_get(uint32_t key) {
+    TriList *l = tri_find(key);
+    if (l) return l;
+    if ((tri_used + 1) * 2 > tri_cap) {
+        size_t ncap = tri_cap ? tri_cap * 2 : 1024;
+        TriList *t = calloc(ncap, sizeof(TriList));
+        if (!t) return NULL;
+        for (size_t i = 0; i < tri_cap; ++i) {
+            if (!tri_slots[i].key) continue;
+            size_t h = tri_hash(tri_slots[i].key) & (ncap - 1);
+            while (t[h].key) h = (h + 1) & (ncap - 1);
+            t[h] = tri_slots[i];
+        }
+        free(tri_slots);
+        tri_slots = t;
+        tri_cap = ncap;
+    }
+    size_t h = tri_hash(key) & (tri_cap - 1);
+    while (tri_slots[h].key) h = (h + 1) & (tri_cap - 1);
+    tri_slots[h].key = key;
+    tri_used++;
+    return &tri_slots[h];
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Distinct trigrams of s[0..n), sorted, into a malloc'd array (or NULL
+ * if there are none); their number in *count */
+static uint32_t *tri_collect(const char *s, size_t n, size_t *count) {
+    *count = 0;
+    if (n < 3) return NULL;
+    uint32_t *keys = malloc((n - 2) * sizeof(uint32_t));
+    if (!keys) return NULL;
+    for (size_t i = 0; i + 2 < n; ++i) keys[i] = tri_key(s + i);
+    qsort(keys, n - 2, sizeof(uint32_t), cmp_u32);
+    size_t k = 0;
+    for (size_t i = 0; i < n - 2; ++i) {
+        if (k == 0 || keys[k-1] != keys[i]) keys[k++] = keys[i];
+    }
+    *count = k;
+    return keys;
+}
+
+static void tri_add(HistEntry *e) {
+    if (!tri_built) return;
+    if (tri_nids == tri_idcap) {
+        size_t ncap = tri_idcap ? tri_idcap * 2 : 256;
+        HistEntry **t = realloc(tri_ids, ncap * sizeof(HistEntry*));
+        if (!t) return;
+        tri_ids = t;
+        tri_idcap = ncap;
+    }
+    uint32_t id = (uint32_t)tri_nids++;
+    tri_ids[id] = e;
+    e->tid = id;
+    tri_live++;
+    size_t nkeys;
+    uint32_t *keys = tri_collect(e->text, e->len, &nkeys);
+    for (size_t i = 0; i < nkeys; ++i) {
+        TriList *l = tri_get(keys[i]);
+        if (!l) continue;
+        if (l->n == l->cap) {
+            uint32_t ncap = l->cap ? l->cap * 2 : 4;
+            uint32_t *t = realloc(l->ids, ncap * sizeof(uint32_t));
+            if (!t) continue;
+            l->ids = t;
+            l->cap = ncap;
+        }
+        l->ids[l->n++] = id;
+    }
+    free(keys);
+}
+
+static void tri_free(void) {
+    for (size_t i = 0; i < tri_cap; ++i) free(tri_slots[i].ids);
+    free(tri_slots);
+    free(tri_ids);
+    tri_slots = NULL;
+    tri_ids = NULL;
+    tri_cap = tri_used = tri_nids = tri_idcap = tri_live = 0;
+    tri_built = 0;
+}
+
+/* (Re)build the index from the live entries, oldest first */
+static void tri_build(void) {
+    tri_free();
+    tri_built = 1;
+    for (size_t s = ring_head; s < ring_tail; ++s) {
+        HistEntry *e = ring[s & (ring_cap - 1)];
+        if (e) tri_add(e);
+    }
+}
+
+static void tri_drop(HistEntry *e) {
+    if (!tri_built || e->tid == TRI_NONE) return;
+    tri_ids[e->tid] = NULL;
+    e->tid = TRI_NONE;
+    tri_live--;
+    if (tri_nids > 2 * tri_live + 1024) tri_build();
+}
+
+/* Whether id is in the ascending list l */
+static int tri_has(const TriList *l, uint32_t id) {
+    size_t lo = 0, hi = l->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < l->n && l->ids[lo] == id;
+}
+
+/* Squeeze the holes out of the ring and make room for at least 'need'
+ * entries, growing it if the live entries leave less than half free.
+ */
+static int ring_repack(size_t need) {
+    size_t ncap = ring_cap ? ring_cap : 16;
+    while (ncap < need * 2) ncap *= 2;
+    HistEntry **t = calloc(ncap, sizeof(HistEntry*));
+    if (!t) return -1;
+    size_t seq = 0;
+    for (size_t s = ring_head; s < ring_tail; ++s) {
+        HistEntry *e = ring[s & (ring_cap - 1)];
+        if (!e) continue;
+        e->seq = seq;
+        t[seq++] = e;
+    }
+    free(ring);
+    ring = t;
+    ring_cap = ncap;
+    ring_head = 0;
+    ring_tail = seq;
+    return 0;
+}
+
+static void entry_free(HistEntry *e) {
+    if (e->owned) free((char *)e->text);
+    if (e->cwd_owned) free((char *)e->meta.cwd);
+    free(e);
+}
+
+/* Unlink entry 'e' from the ring and the index */
+static void entry_drop(HistEntry *e) {
+    ring[e->seq & (ring_cap - 1)] = NULL;
+    index_remove(e);
+    tri_drop(e);
+    history_len--;
+    /* keep ring_head on the oldest live entry */
+    while (ring_head < ring_tail && !ring[ring_head & (ring_cap - 1)]) ring_head++;
+    entry_free(e);
+}
+
+static void unmap_journal(void) {
+    /* until loaded, the newest record may point into the mapping */
+    if (last_text && last_text != last_owned) {
+        last_text = NULL;
+        last_len = 0;
+    }
+    if (map_base) munmap(map_base, map_len);
+    map_base = NULL;
+    map_len = 0;
+}
+
+static void free_history_in_memory(void) {
+    for (size_t s = ring_head; s < ring_tail; ++s) {
+        HistEntry *e = ring[s & (ring_cap - 1)];
+        if (e) entry_free(e);
+    }
+    tri_free();
+    free(ring);
+    free(index_slots);
+    ring = NULL;
+    index_slots = NULL;
+    ring_cap = index_cap = index_used = 0;
+    ring_head = ring_tail = 0;
+    history_len = 0;
+    free(last_owned);
+    last_owned = NULL;
+    last_text = NULL;
+    last_len = 0;
+    unmap_journal();
+}
+
+/* Drop the oldest entries until at most 'max' remain */
+static void evict_to(size_t max) {
+    while (history_len > max) entry_drop(ring[ring_head & (ring_cap - 1)]);
+}
+
+static HistEntry *newest_entry(void) {
+    return history_len ? ring[(ring_tail - 1) & (ring_cap - 1)] : NULL;
+}
+
+/* Fold the run(s) described by 'm' into e's metadata. A record of a single
+ * run carries no totals (m->runs == 0). */
+static void entry_add_meta(HistEntry *e, const HistMeta *m, int in_place) {
+    HistMeta *em = &e->meta;
+    size_t runs = m->runs ? m->runs : 1;
+    em->failures += m->runs ? m->failures : (m->status > 0);
+    em->total_us += m->runs ? m->total_us : (m->duration_us > 0 ? m->duration_us : 0);
+    int latest = em->runs == 0 || m->start >= em->start;
+    em->runs += runs;
+    if (!latest) return;
+    em->start = m->start;
+    em->duration_us = m->duration_us;
+    em->status = m->status;
+    if (e->cwd_owned) free((char *)em->cwd);
+    e->cwd_owned = 0;
+    em->cwd = NULL;
+    em->cwd_len = 0;
+    if (!m->cwd) return;
+    if (in_place) {
+        em->cwd = m->cwd;
+    } else {
+        char *copy = malloc(m->cwd_len + 1);
+        if (!copy) return;
+        memcpy(copy, m->cwd, m->cwd_len);
+        copy[m->cwd_len] = '\0';
+        em->cwd = copy;
+        e->cwd_owned = 1;
+    }
+    em->cwd_len = m->cwd_len;
+}
+
+/* Apply the recording rules to the in-memory list, folding in the run
+ * metadata 'm' if there is any. A new entry references 'line' (and the
+ * metadata's cwd) in place if 'in_place' is set (it lives in the mapping)
+ * and holds a copy otherwise. Returns 1 if added, 0 if 'line' already is
+ * the newest entry, -1 on error.
+ */
+static int memory_add(const char *line, size_t len, const HistMeta *m, int in_place) {
+    size_t hash = hash_text(line, len);
+    HistEntry **slot = index_find(line, len, hash);
+    HistEntry *e = slot ? *slot : NULL;
+    /* exact duplicate prevention vs last stored (most recent) */
+    if (e && e == newest_entry()) {
+        if (m) entry_add_meta(e, m, in_place);
+        return 0;
+    }
+
+    if (e) {
+        /* already stored: move it to the newest slot, leaving a hole */
+        ring[e->seq & (ring_cap - 1)] = NULL;
+        while (ring_head < ring_tail && !ring[ring_head & (ring_cap - 1)]) ring_head++;
+    } else {
+        e = calloc(1, sizeof(HistEntry));
+        if (!e) return -1;
+        if (in_place) {
+            e->text = line;
+        } else {
+            char *copy = malloc(len + 1);
+            if (!copy) { free(e); return -1; }
+            memcpy(copy, line, len);
+            copy[len] = '\0';
+            e->text = copy;
+            e->owned = 1;
+        }
+        e->len = len;
+        e->hash = hash;
+        e->tid = TRI_NONE;
+        if (index_insert(e) != 0) {
+            entry_free(e);
+            return -1;
+        }
+        history_len++;
+    }
+    if (ring_tail - ring_head >= ring_cap && ring_repack(history_len) != 0) {
+        /* cannot place it: forget the entry rather than corrupt the ring */
+        index_remove(e);
+        tri_drop(e);
+        history_len--;
+        entry_free(e);
+        return -1;
+    }
+    e->seq = ring_tail++;
+    ring[e->seq & (ring_cap - 1)] = e;
+    if (e->tid == TRI_NONE) tri_add(e);
+    if (m) entry_add_meta(e, m, in_place);
+    evict_to(hist_max);
+    return 1;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+
+static int journal_open(void) {
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = open(journal_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    return journal_fd >= 0 ? 0 : -1;
+}
+
+static void journal_lock(int op) {
+    if (lock_fd < 0) return;
+    while (flock(lock_fd, op) != 0 && errno == EINTR) {
+        /* retry */
+    }
+}
+
+/* Whether 'fd' is the file described by 'st' */
+static int same_file(int fd, const struct stat *st) {
+    struct stat fst;
+    return fstat(fd, &fst) == 0 && fst.st_dev == st->st_dev && fst.st_ino == st->st_ino;
+}
+
+/* Map the whole journal read-only, replacing any earlier mapping, and keep
+ * it open for incremental reads. A missing or empty file leaves nothing
+ * mapped. Returns -1 if mmap fails.
+ */
+static int journal_map(void) {
+    unmap_journal();
+    if (journal_rfd >= 0) close(journal_rfd);
+    journal_rfd = open(journal_path, O_RDONLY | O_CLOEXEC);
+    if (journal_rfd < 0) return 0;   /* silent: history file may not exist */
+    struct stat st;
+    int r = 0;
+    if (fstat(journal_rfd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, journal_rfd, 0);
+        if (p != MAP_FAILED) {
+            map_base = p;
+            map_len = (size_t)st.st_size;
+        } else {
+            r = -1;
+        }
+    }
+    return r;
+}
+
+/* Length of the record at 'rec' (n bytes before its newline) without a
+ * trailing CR */
+static size_t record_len(const char *rec, size_t n) {
+    while (n > 0 && rec[n-1] == '\r') n--;
+    return n;
+}
+
+static long long parse_ll(const char *p, const char *end) {
+    long long v = 0;
+    int neg = p < end && *p == '-';
+    if (neg) p++;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    return neg ? -v : v;
+}
+
+/* Split the record rec[0..n) into its command (*cmd, *cmdlen) and, for a
+ * metadata record, its tags. Returns 1 if 'm' was filled in.
+ */
+static int record_parse(const char *rec, size_t n, const char **cmd, size_t *cmdlen,
+                        HistMeta *m) {
+    *cmd = rec;
+    *cmdlen = n;
+    if (n == 0 || rec[0] != TAG_MARK) return 0;
+    const char *end = memchr(rec + 1, TAG_MARK, n - 1);
+    if (!end) return 0;   /* not ours: keep it as typed */
+    memset(m, 0, sizeof(*m));
+    m->duration_us = -1;
+    m->status = -1;
+    const char *p = rec + 1;
+    while (p + 1 < end && p[1] == '=') {
+        char key = p[0];
+        const char *v = p + 2;
+        if (key == 'c') {
+            /* last tag: the rest is the directory, ';' included */
+            m->cwd = v;
+            m->cwd_len = (size_t)(end - v);
+            break;
+        }
+        const char *semi = memchr(v, ';', (size_t)(end - v));
+        const char *vend = semi ? semi : end;
+        long long x = parse_ll(v, vend);
+        switch (key) {
+        case 's': m->start = x; break;
+        case 'd': m->duration_us = x; break;
+        case 'x': m->status = (int)x; break;
+        case 'n': m->runs = (size_t)x; break;
+        case 'f': m->failures = (size_t)x; break;
+        case 't': m->total_us = x; break;
+        default: break;   /* unknown tags are skipped */
+        }
+        if (!semi) break;
+        p = semi + 1;
+    }
+    *cmd = end + 1;
+    *cmdlen = (size_t)(rec + n - *cmd);
+    return 1;
+}
+
+/* Replay the complete records in buf[0..n) (referenced in place or copied)
+ * and return the number of bytes consumed; a torn record is left over.
+ */
+static size_t replay_records(const char *buf, size_t n, int in_place) {
+    const char *p = buf, *end = buf + n;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) break;
+        journal_records++;
+        const char *cmd;
+        size_t len;
+        HistMeta m;
+        int has_meta = record_parse(p, record_len(p, (size_t)(nl - p)), &cmd, &len, &m);
+        if (len > 0) memory_add(cmd, len, has_meta ? &m : NULL, in_place);
+        p = nl + 1;
+    }
+    return (size_t)(p - buf);
+}
+
+/* Build the ring and index from the journal on first access. Only
+ * newline-terminated records count.
+ */
+static void history_load(void) {
+    if (loaded) return;
+    loaded = 1;
+    free(last_owned);
+    last_owned = NULL;
+    last_text = NULL;
+    last_len = 0;
+    journal_records = 0;
+    read_off = 0;
+    /* remap: this session's appends are replayed along with the rest */
+    if (!journal_path || journal_map() != 0) return;
+    if (map_base) read_off = (off_t)replay_records(map_base, map_len, 1);
+}
+
+/* Merge what other sessions appended since the last read; records are
+ * replayed in file order, so every session converges on the same view.
+ */
+static void history_sync(void) {
+    if (!loaded) {
+        history_load();
+        return;
+    }
+    if (!journal_path) return;
+    struct stat st;
+    if (stat(journal_path, &st) != 0) return;
+    if (journal_rfd < 0 || !same_file(journal_rfd, &st) || st.st_size < read_off) {
+        /* replaced by a compaction, which merged everything this session
+         * had written: start over from the new file */
+        free_history_in_memory();
+        loaded = 0;
+        history_load();
+        return;
+    }
+    if (st.st_size == read_off) return;
+    size_t want = (size_t)(st.st_size - read_off);
+    char *buf = malloc(want);
+    if (!buf) return;
+    ssize_t got = pread(journal_rfd, buf, want, read_off);
+    if (got > 0) read_off += (off_t)replay_records(buf, (size_t)got, 0);
+    free(buf);
+}
+
+/* Rewrite the journal as exactly the live entries: write a temporary file
+ * next to it, fsync, and rename it into place. The caller holds the lock
+ * exclusively; 'merge' first picks up records other sessions appended.
+ */
+static int journal_compact_locked(int merge) {
+    if (!journal_path) return -1;
+    if (merge) history_sync();
+    size_t plen = strlen(journal_path);
+    char *tmp = malloc(plen + 32);
+    if (!tmp) return -1;
+    snprintf(tmp, plen + 32, "%s.%ld.tmp", journal_path, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { free(tmp); return -1; }
+
+    FILE *f = fdopen(fd, "w");
+    if (!f) { close(fd); unlink(tmp); free(tmp); return -1; }
+    for (size_t i = ring_head; i < ring_tail; ++i) {
+        HistEntry *e = ring[i & (ring_cap - 1)];
+        if (!e) continue;
+        const HistMeta *m = &e->meta;
+        if (m->runs) {
+            /* one record carries the latest run and the totals */
+            fprintf(f, "%cs=%lld;d=%lld;x=%d;n=%zu;f=%zu;t=%lld;c=", TAG_MARK, m->start,
+                    m->duration_us, m->status, m->runs, m->failures, m->total_us);
+            if (m->cwd) fwrite(m->cwd, 1, m->cwd_len, f);
+            fputc(TAG_MARK, f);
+        }
+        fwrite(e->text, 1, e->len, f);
+        fputc('\n', f);
+    }
+    int ok = fflush(f) == 0 && fsync(fd) == 0;
+    off_t written = ftello(f);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, journal_path) != 0) {
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    journal_records = history_len;
+    /* the new file holds exactly what is in memory */
+    if (journal_rfd >= 0) close(journal_rfd);
+    journal_rfd = open(journal_path, O_RDONLY | O_CLOEXEC);
+    read_off = written;
+    return journal_open();
+}
+
+static int journal_compact(int merge) {
+    journal_lock(LOCK_EX);
+    int r = journal_compact_locked(merge);
+    journal_lock(LOCK_UN);
+    return r;
+}
+
+/* Append one record with a single write() so it lands whole or not at all */
+static int journal_append(const char *line, size_t n) {
+    if (journal_fd < 0) return -1;
+    char stackbuf[512];
+    char *rec = n + 1 <= sizeof(stackbuf) ? stackbuf : malloc(n + 1);
+    if (!rec) return -1;
+    memcpy(rec, line, n);
+    rec[n] = '\n';
+    journal_lock(LOCK_SH);
+    /* follow the file if another session's compaction replaced it */
+    struct stat st;
+    int r = 0;
+    if (stat(journal_path, &st) != 0 || !same_file(journal_fd, &st)) r = journal_open();
+    if (r == 0) r = write_all(journal_fd, rec, n + 1);
+    journal_lock(LOCK_UN);
+    /* once loaded, the record is counted when it is read back */
+    if (r == 0 && !loaded) journal_records++;
+    if (rec != stackbuf) free(rec);
+    return r;
+}
+
+/* Find the newest complete record by scanning back from the end of the
+ * mapping. Returns 1 if the file ends in a torn record.
+ */
+static int journal_scan_tail(void) {
+    if (!map_base) return 0;
+    size_t end = map_len;
+    int torn = map_base[end - 1] != '\n';
+    while (end > 0 && map_base[end - 1] != '\n') end--;
+    while (end > 0) {
+        size_t start = end - 1;
+        while (start > 0 && map_base[start - 1] != '\n') start--;
+        const char *cmd;
+        size_t n;
+        HistMeta m;
+        record_parse(map_base + start, record_len(map_base + start, end - 1 - start),
+                     &cmd, &n, &m);
+        if (n > 0) {
+            last_text = cmd;
+            last_len = n;
+            break;
+        }
+        end = start;
+    }
+    return torn;
+}
+
+int history_init(void) {
+    free_history_in_memory();
+    loaded = 0;
+    const char *env = getenv("OSH_HISTSIZE");
+    if (env) {
+        char *end;
+        unsigned long v = strtoul(env, &end, 10);
+        if (*end == '\0' && v > 0) hist_max = (size_t)v;
+    }
+    free(journal_path);
+    free(lock_path);
+    journal_path = join_path_home(HIST_FILENAME);
+    lock_path = join_path_home(LOCK_FILENAME);
+    if (!journal_path || !lock_path) return -1;
+    if (lock_fd >= 0) close(lock_fd);
+    lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    journal_records = 0;
+    journal_pid = getpid();
+    static int registered = 0;
+    if (!registered) {
+        /* leave a compact journal behind on every exit path (Ctrl-D, exit()) */
+        atexit(history_cleanup);
+        registered = 1;
+    }
+    /* startup cost is independent of the journal size: map it and look at
+     * its tail only */
+    if (journal_map() == 0 && journal_scan_tail()) {
+        /* a torn tail would be glued to the next append; this rare case
+         * still loads and compacts right away. The exclusive lock waits
+         * out appends in flight, so only a real tear gets here twice. */
+        journal_lock(LOCK_EX);
+        int r = -1;
+        if (journal_map() == 0 && journal_scan_tail()) {
+            history_load();
+            r = journal_compact_locked(1);
+        }
+        journal_lock(LOCK_UN);
+        if (r == 0) return 0;
+    }
+    return journal_open();
+}
+
+/* Records in the journal while not loaded: newlines in the startup
+ * mapping plus this session's appends */
+static size_t unloaded_records(void) {
+    size_t n = journal_records;
+    const char *p = map_base, *end = map_base + map_len;
+    while (p && p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+void history_cleanup(void) {
+    if (journal_path && getpid() == journal_pid) {
+        /* exiting in the middle of a command (Ctrl-D): status unknown */
+        history_finish(-1);
+        /* sessions that never read the history pay for compaction only
+         * when the journal has grown long */
+        if (!loaded && unloaded_records() > COMPACT_FACTOR * hist_max) history_load();
+        if (loaded) {
+            journal_lock(LOCK_EX);
+            history_sync();
+            if (journal_records != history_len) journal_compact_locked(0);
+            journal_lock(LOCK_UN);
+        }
+    }
+    if (journal_fd >= 0) close(journal_fd);
+    if (journal_rfd >= 0) close(journal_rfd);
+    if (lock_fd >= 0) close(lock_fd);
+    journal_fd = journal_rfd = lock_fd = -1;
+    free_history_in_memory();
+    free(journal_path);
+    free(lock_path);
+    journal_path = lock_path = NULL;
+}
+
+/* Sanitize a working directory for the c= tag */
+static char *current_dir(void) {
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) return NULL;
+    for (char *p = cwd; *p; ++p) {
+        if (*p == '\n' || *p == TAG_MARK) *p = '?';
+    }
+    return cwd;
+}
+
+int history_add(const char *line) {
+    /* a run nobody finished (should not happen) is written without status */
+    history_finish(-1);
+    size_t len = strlen(line);
+    int r = 1;
+    if (!loaded) {
+        /* until the history is read only the newest record matters; the
+         * replay on first access applies the full rules */
+        if (last_text && last_len == len && memcmp(last_text, line, len) == 0) {
+            r = 0;
+        } else {
+            char *copy = strdup(line);
+            free(last_owned);
+            last_owned = copy;
+            last_text = copy;
+            last_len = copy ? len : 0;
+        }
+    } else {
+        r = memory_add(line, len, NULL, 0);
+        if (r < 0) return -1;
+    }
+    /* even a repeat of the newest entry is a run worth timing */
+    pending.line = strdup(line);
+    if (!pending.line) return -1;
+    pending.start = (long long)time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &pending.t0);
+    pending.cwd = current_dir();
+    return r;
+}
+
+void history_finish(int status) {
+    if (!pending.line) return;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    HistMeta m;
+    memset(&m, 0, sizeof(m));
+    m.start = pending.start;
+    m.duration_us = (long long)(t1.tv_sec - pending.t0.tv_sec) * 1000000 +
+                    (t1.tv_nsec - pending.t0.tv_nsec) / 1000;
+    m.status = status;
+    m.cwd = pending.cwd;
+    m.cwd_len = pending.cwd ? strlen(pending.cwd) : 0;
+
+    size_t len = strlen(pending.line);
+    size_t cap = len + m.cwd_len + 128;
+    char *rec = malloc(cap);
+    int n = rec ? snprintf(rec, cap, "%cs=%lld;d=%lld;x=%d;c=%s%c%s", TAG_MARK, m.start,
+                           m.duration_us, m.status, pending.cwd ? pending.cwd : "",
+                           TAG_MARK, pending.line) : -1;
+    if (n > 0 && journal_append(rec, (size_t)n) == 0) {
+        /* read it back with whatever other sessions appended before it */
+        if (loaded) history_sync();
+    } else if (loaded) {
+        memory_add(pending.line, len, &m, 0);
+    }
+    free(rec);
+    free(pending.line);
+    free(pending.cwd);
+    pending.line = NULL;
+    pending.cwd = NULL;
+    if (loaded && journal_records > COMPACT_FACTOR * hist_max) journal_compact(1);
+}
+
+size_t history_count(void) {
+    history_sync();
+    return history_len;
+}
+
+const char *history_get(size_t i, size_t *len) {
+    history_load();
+    if (i >= history_len) return NULL;
+    /* positional access needs a hole-free ring */
+    if (ring_tail - ring_head != history_len && ring_repack(history_len) != 0) return NULL;
+    const HistEntry *e = ring[(ring_head + i) & (ring_cap - 1)];
+    *len = e->len;
+    return e->text;
+}
+
+/* Whether s[0..n) contains q[0..m) */
+static int contains(const char *s, size_t n, const char *q, size_t m) {
+    if (m > n) return 0;
+    const char *p = s, *last = s + (n - m);
+    while (p <= last && (p = memchr(p, q[0], (size_t)(last - p) + 1)) != NULL) {
+        if (memcmp(p, q, m) == 0) return 1;
+        p++;
+    }
+    return 0;
+}
+
+static int cmp_seq_desc(const void *a, const void *b) {
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return x > y ? -1 : x < y;
+}
+
+size_t history_search(const char *q, size_t qlen, size_t *out, size_t max) {
+    history_sync();
+    if (qlen == 0 || max == 0 || history_len == 0) return 0;
+    /* positions are reported like history_get() indexes them */
+    if (ring_tail - ring_head != history_len && ring_repack(history_len) != 0) return 0;
+    size_t found = 0;
+    if (qlen < 3) {
+        /* too short for a trigram: scan from the newest entry */
+        for (size_t s = ring_tail; s > ring_head && found < max; --s) {
+            const HistEntry *e = ring[(s - 1) & (ring_cap - 1)];
+            if (contains(e->text, e->len, q, qlen)) out[found++] = s - 1 - ring_head;
+        }
+        return found;
+    }
+
+    if (!tri_built) tri_build();
+    size_t nkeys;
+    uint32_t *keys = tri_collect(q, qlen, &nkeys);
+    if (!keys) return 0;
+    /* intersect the posting lists, driving the walk from the shortest */
+    const TriList **lists = malloc(nkeys * sizeof(TriList*));
+    size_t *seqs = NULL, nseqs = 0;
+    if (!lists) { free(keys); return 0; }
+    size_t shortest = 0;
+    for (size_t i = 0; i < nkeys; ++i) {
+        lists[i] = tri_find(keys[i]);
+        if (!lists[i]) goto out;
+        if (lists[i]->n < lists[shortest]->n) shortest = i;
+    }
+    seqs = malloc(lists[shortest]->n * sizeof(size_t));
+    if (!seqs) goto out;
+    for (uint32_t j = 0; j < lists[shortest]->n; ++j) {
+        uint32_t id = lists[shortest]->ids[j];
+        const HistEntry *e = tri_ids[id];
+        if (!e) continue;
+        size_t i = 0;
+        while (i < nkeys && (i == shortest || tri_has(lists[i], id))) i++;
+        /* trigrams can match out of order: confirm the substring */
+        if (i == nkeys && contains(e->text, e->len, q, qlen)) seqs[nseqs++] = e->seq;
+    }
+    qsort(seqs, nseqs, sizeof(size_t), cmp_seq_desc);
+    for (found = 0; found < nseqs && found < max; ++found) out[found] = seqs[found] - ring_head;
+out:
+    free(seqs);
+    free(lists);
+    free(keys);
+    return found;
+}
+
+/* Trigrams of a query looked up by history_search_older(); the rest of a
+ * longer query is left to contains() */
+#define TRI_QUERY_MAX 32
+
+int history_search_older(const char *q, size_t qlen, size_t before, size_t *out) {
+    history_sync();
+    if (qlen == 0 || history_len == 0) return 0;
+    if (ring_tail - ring_head != history_len && ring_repack(history_len) != 0) return 0;
+    if (before > history_len) before = history_len;
+    size_t bound = ring_head + before;
+    if (qlen < 3) {
+        for (size_t s = bound; s > ring_head; --s) {
+            const HistEntry *e = ring[(s - 1) & (ring_cap - 1)];
+            if (contains(e->text, e->len, q, qlen)) {
+                *out = s - 1 - ring_head;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (!tri_built) tri_build();
+    const TriList *lists[TRI_QUERY_MAX];
+    size_t nlists = 0, shortest = 0;
+    for (size_t i = 0; i + 2 < qlen && nlists < TRI_QUERY_MAX; ++i) {
+        const TriList *l = tri_find(tri_key(q + i));
+        if (!l) return 0;
+        size_t k = 0;
+        while (k < nlists && lists[k] != l) k++;
+        if (k < nlists) continue;
+        if (nlists == 0 || l->n < lists[shortest]->n) shortest = nlists;
+        lists[nlists++] = l;
+    }
+    /* a long list means matches are dense: walking back through the ring
+     * finds the next one sooner, so try that for as many entries as the
+     * list holds before walking the list */
+    const TriList *ls = lists[shortest];
+    for (size_t budget = ls->n; bound > ring_head && budget > 0; --bound, --budget) {
+        const HistEntry *e = ring[(bound - 1) & (ring_cap - 1)];
+        if (contains(e->text, e->len, q, qlen)) {
+            *out = bound - 1 - ring_head;
+            return 1;
+        }
+    }
+    /* ids do not follow the ring order (a repeated line keeps its id), so
+     * the whole list is walked for the newest match below bound */
+    const HistEntry *best = NULL;
+    for (uint32_t j = 0; j < ls->n; ++j) {
+        uint32_t id = ls->ids[j];
+        const HistEntry *e = tri_ids[id];
+        if (!e || e->seq >= bound || (best && e->seq < best->seq)) continue;
+        size_t i = 0;
+        while (i < nlists && (i == shortest || tri_has(lists[i], id))) i++;
+        if (i == nlists && contains(e->text, e->len, q, qlen)) best = e;
+    }
+    if (!best) return 0;
+    *out = best->seq - ring_head;
+    return 1;
+}
+
+const HistMeta *history_get_meta(size_t i) {
+    history_load();
+    if (i >= history_len) return NULL;
+    if (ring_tail - ring_head != history_len && ring_repack(history_len) != 0) return NULL;
+    const HistEntry *e = ring[(ring_head + i) & (ring_cap - 1)];
+    return e->meta.runs ? &e->meta : NULL;
+}
+
+size_t history_get_max(void) {
+    return hist_max;
+}
+
+void history_set_max(size_t max) {
+    if (max == 0) return;
+    history_sync();
+    hist_max = max;
+    evict_to(hist_max);
+    journal_compact(1);
+}
+
+void history_purge(void) {
+    journal_lock(LOCK_EX);
+    free_history_in_memory();
+    loaded = 1;
+    journal_compact_locked(0);
+    journal_lock(LOCK_UN);
+}
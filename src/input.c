@@ -0,0 +1,117 @@
+#define _POSIX_C_SOURCE 200809L
+#include "input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* Smallest read we bother to make room for */
+#define INPUT_MIN_READ 4096
+
+static char *ring = NULL;
+static size_t ring_cap = 0;           /* power of two */
+static size_t ring_head = 0, ring_tail = 0;   /* free-running counters */
+
+size_t input_pending(void) {
+    return ring_tail - ring_head;
+}
+
+/* Make sure at least 'want' bytes are free, growing (and unwrapping) the ring */
+static int ensure_space(size_t want) {
+    size_t used = input_pending();
+    if (ring_cap - used >= want) return 0;
+    size_t ncap = ring_cap ? ring_cap : INPUT_MIN_READ * 4;
+    while (ncap - used < want) ncap *= 2;
+    char *t = malloc(ncap);
+    if (!t) return -1;
+    input_copy(t, used);
+    free(ring);
+    ring = t;
+    ring_cap = ncap;
+    ring_head = 0;
+    ring_tail = used;
+    return 0;
+}
+
+long input_fill(void) {
+    if (ensure_space(INPUT_MIN_READ) != 0) return -1;
+    /* one read into the contiguous free span at the tail */
+    size_t off = ring_tail & (ring_cap - 1);
+    size_t head_off = ring_head & (ring_cap - 1);
+    size_t span = ring_cap - off;
+    if (input_pending() > 0 && head_off > off) span = head_off - off;
+    else if (input_pending() == 0) {
+        ring_head = ring_tail = 0;
+        off = 0;
+        span = ring_cap;
+    }
+    ssize_t r;
+    do {
+        r = read(STDIN_FILENO, ring + off, span);
+    } while (r < 0 && errno == EINTR);
+    if (r > 0) ring_tail += (size_t)r;
+    return (long)r;
+}
+
+long input_fill_timeout(int timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int pres;
+    do {
+        pres = poll(&pfd, 1, timeout_ms);
+    } while (pres < 0 && errno == EINTR);
+    if (pres <= 0) return pres;
+    return input_fill();
+}
+
+size_t input_peek(const char **p) {
+    size_t used = input_pending();
+    if (used == 0) {
+        *p = NULL;
+        return 0;
+    }
+    size_t off = ring_head & (ring_cap - 1);
+    size_t span = ring_cap - off;
+    *p = ring + off;
+    return used < span ? used : span;
+}
+
+size_t input_copy(char *dst, size_t n) {
+    size_t used = input_pending();
+    if (n > used) n = used;
+    size_t off = ring_head & (ring_cap - 1);
+    size_t first = ring_cap - off < n ? ring_cap - off : n;
+    if (first) memcpy(dst, ring + off, first);
+    if (n > first) memcpy(dst + first, ring, n - first);
+    return n;
+}
+
+int input_tail_contains(size_t n, char c) {
+    if (n > input_pending()) n = input_pending();
+    for (size_t i = ring_tail - n; i < ring_tail; ++i) {
+        if (ring[i & (ring_cap - 1)] == c) return 1;
+    }
+    return 0;
+}
+
+void input_consume(size_t n) {
+    if (n > input_pending()) n = input_pending();
+    ring_head += n;
+}
+
+int input_getc(void) {
+    if (input_pending() == 0 && input_fill() <= 0) return -1;
+    unsigned char c = (unsigned char)ring[ring_head & (ring_cap - 1)];
+    ring_head++;
+    return c;
+}
+
+void input_cleanup(void) {
+    free(ring);
+    ring = NULL;
+    ring_cap = ring_head = ring_tail = 0;
+}
@@ -1,5 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 #include "intrinsics.h"
+#include "arena.h"
+#include "history.h"
+#include "reveal.h"
+#include "dircache.h"
+#include "frecency.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,7 +13,6 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
-#include <dirent.h>
 #include <ctype.h>
 #include <sys/stat.h>
 
@@ -16,180 +20,40 @@
 #define PATH_MAX 4096
 #endif
 
-/* Make HIST_MAX a compile-time constant so we can use it to size file-scope arrays */
-#ifndef HIST_MAX
-#define HIST_MAX 15
-#endif
-
-/* History persistence file name within $HOME */
-static const char *HIST_FILENAME = ".osh_history";
-
-/* In-memory history: oldest..newest */
-static char *history_buf[HIST_MAX];
-static size_t history_count = 0;
-static int history_dirty = 0;
-
 /* prev cwd used by '-' argument */
 static char prev_cwd[PATH_MAX+1];
 static int prev_cwd_set = 0;
 
-/* helpers */
-static char *join_path_home(const char *name) {
-    const char *home = getenv("HOME");
-    if (!home) return NULL;
-    size_t n = strlen(home) + 1 + strlen(name) + 1;
-    char *p = malloc(n);
-    if (!p) return NULL;
-    snprintf(p, n, "%s/%s", home, name);
-    return p;
-}
-
-static void free_history_in_memory(void) {
-    for (size_t i = 0; i < history_count; ++i) {
-        free(history_buf[i]);
-        history_buf[i] = NULL;
-    }
-    history_count = 0;
-    history_dirty = 0;
-}
-
-static int load_history_from_file(void) {
-    char *path = join_path_home(HIST_FILENAME);
-    if (!path) return -1;
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        free(path);
-        /* silent: history file may not exist */
-        return 0;
-    }
-    char *line = NULL;
-    size_t cap = 0;
-    ssize_t n;
-    /* We'll keep only the last HIST_MAX entries (oldest..newest) */
-    char *tmp_buf[HIST_MAX * 2]; /* temporary flexible buffer */
-    size_t tmp_count = 0;
-    while ((n = getline(&line, &cap, f)) != -1) {
-        /* trim trailing newline */
-        while (n > 0 && (line[n-1] == '\n' || line[n-1] == '\r')) {
-            line[--n] = '\0';
-        }
-        if (n == 0) continue;
-        tmp_buf[tmp_count++] = strdup(line);
-        if (tmp_count >= sizeof(tmp_buf)/sizeof(tmp_buf[0])) break;
-    }
-    free(line);
-    fclose(f);
-    free(path);
-
-    /* Keep only the last HIST_MAX entries */
-    size_t start = 0;
-    if (tmp_count > HIST_MAX) start = tmp_count - HIST_MAX;
-    for (size_t i = start; i < tmp_count; ++i) {
-        history_buf[history_count++] = tmp_buf[i]; /* transfer ownership */
-    }
-    /* free any earlier entries from tmp_buf[] */
-    for (size_t i = 0; i < start; ++i) free(tmp_buf[i]);
-    history_dirty = 0;
-    return 0;
-}
-
-static int save_history_to_file(void) {
-    char *path = join_path_home(HIST_FILENAME);
-    if (!path) return -1;
-    FILE *f = fopen(path, "w");
-    if (!f) {
-        free(path);
-        return -1;
-    }
-    for (size_t i = 0; i < history_count; ++i) {
-        fprintf(f, "%s\n", history_buf[i]);
-    }
-    fclose(f);
-    free(path);
-    history_dirty = 0;
-    return 0;
-}
-
-/* return 1 if the provided line contains an atomic command whose command name
- * is exactly "log" (the first name of any atomic). We only need to detect the
- * atomic names, not arbitrary occurrences of "log".
- */
-static int line_contains_atomic_log(const char *line) {
-    if (!line) return 0;
-    const char *s = line;
-    while (*s) {
-        /* skip whitespace */
-        while (*s && isspace((unsigned char)*s)) ++s;
-        if (!*s) break;
-        /* skip separators */
-        if (*s == '|' || *s == ';' || *s == '&') {
-            ++s;
-            continue;
-        }
-        /* start of an atomic command; the first token is its name */
-        const char *start = s;
-        while (*s && !isspace((unsigned char)*s) && *s != '|' && *s != ';' && *s != '&' && *s != '<' && *s != '>' ) ++s;
-        size_t len = (size_t)(s - start);
-        if (len == 3 && strncmp(start, "log", 3) == 0) {
-            return 1;
+/* Directories left by hop, most recent first ("hop +N"); entry 1 is
+ * prev_cwd. Neither the cwd nor duplicates are kept. */
+#define DIRSTACK_MAX 20
+static char *dir_stack[DIRSTACK_MAX];
+static size_t dir_depth = 0;
+
+/* return 1 if any atomic in the parsed line has the command name "log" */
+static int line_contains_atomic_log(const CmdLine *cl) {
+    if (!cl) return 0;
+    for (size_t g = 0; g < cl->ngroups; ++g) {
+        const CmdGroup *grp = &cl->groups[g];
+        for (size_t i = 0; i < grp->ncmds; ++i) {
+            if (strcmp(grp->cmds[i].argv[0], "log") == 0) return 1;
         }
-        /* skip rest of this atomic until separator or end */
-        while (*s && *s != '|' && *s != ';' && *s != '&') ++s;
     }
     return 0;
 }
 
 /* Add to history (older->newer). Returns 1 if added, 0 if skipped, -1 on error */
-int intrinsics_record_command(const char *line) {
+int intrinsics_record_command(const char *line, const CmdLine *cl) {
     if (!line) return 0;
     /* check atomic 'log' presence */
-    if (line_contains_atomic_log(line)) return 0;
-
-    /* exact duplicate prevention vs last stored (most recent) */
-    if (history_count > 0 && strcmp(history_buf[history_count - 1], line) == 0) {
-        return 0; /* identical to previous, do not store */
-    }
-
-    /* If the command exists anywhere in history already, remove that occurrence
-     * so we keep history entries unique and move this command to the newest slot.
-     */
-    for (size_t i = 0; i < history_count; ++i) {
-        if (strcmp(history_buf[i], line) == 0) {
-            free(history_buf[i]);
-            /* shift left entries after i */
-            if (i + 1 < history_count) {
-                memmove(&history_buf[i], &history_buf[i+1], sizeof(char*) * (history_count - i - 1));
-            }
-            history_count--;
-            break;
-        }
-    }
-
-    char *copy = strdup(line);
-    if (!copy) return -1;
-
-    if (history_count == HIST_MAX) {
-        /* drop oldest */
-        free(history_buf[0]);
-        /* shift */
-        memmove(&history_buf[0], &history_buf[1], sizeof(char*) * (HIST_MAX - 1));
-        history_buf[HIST_MAX - 1] = copy;
-    } else {
-        history_buf[history_count++] = copy;
-    }
-    history_dirty = 1;
-    /* persist immediately so history survives crashes between commands */
-    if (save_history_to_file() != 0) {
-        /* non-fatal, but report */
-        return 1;
-    }
-    return 1;
+    if (line_contains_atomic_log(cl)) return 0;
+    /* one appended journal record; nothing is rewritten */
+    return history_add(line);
 }
 
 /* Public init/cleanup */
 int intrinsics_init(void) {
-    free_history_in_memory();
-    if (load_history_from_file() != 0) {
+    if (history_init() != 0) {
         /* continue even on load failure */
     }
     prev_cwd_set = 0;
@@ -198,62 +62,40 @@ int intrinsics_init(void) {
 }
 
 void intrinsics_cleanup(void) {
-    /* persist if dirty */
-    if (history_dirty) save_history_to_file();
-    free_history_in_memory();
+    history_cleanup();
+    frecency_cleanup();
+    for (size_t i = 0; i < dir_depth; ++i) free(dir_stack[i]);
+    dir_depth = 0;
 }
 
-/* Utility: split a line into tokens by whitespace (returns dynamic array)
- * The caller must free the returned array and its contents.
- * The array is NULL-terminated.
- */
-static char **tokenize_whitespace(const char *line, size_t *out_count) {
-    if (!line) {
-        if (out_count) *out_count = 0;
-        return NULL;
-    }
-    size_t cap = 8;
-    size_t n = 0;
-    char **arr = malloc(sizeof(char*) * cap);
-    if (!arr) return NULL;
-
-    const char *p = line;
-    while (*p) {
-        while (*p && isspace((unsigned char)*p)) ++p;
-        if (!*p) break;
-        const char *start = p;
-        while (*p && !isspace((unsigned char)*p)) ++p;
-        size_t len = (size_t)(p - start);
-        char *tok = malloc(len + 1);
-        if (!tok) {
-            /* cleanup */
-            for (size_t i = 0; i < n; ++i) free(arr[i]);
-            free(arr);
-            return NULL;
-        }
-        memcpy(tok, start, len);
-        tok[len] = '\0';
-        if (n + 1 >= cap) {
-            cap *= 2;
-            char **tmp = realloc(arr, sizeof(char*) * cap);
-            if (!tmp) {
-                for (size_t i = 0; i < n; ++i) free(arr[i]);
-                free(tok);
-                free(arr);
-                return NULL;
-            }
-            arr = tmp;
-        }
-        arr[n++] = tok;
+/* ----------- hop implementation ----------- */
+
+/* Drop 'path' from the directory stack if it is there */
+static void dir_stack_remove(const char *path) {
+    for (size_t i = 0; i < dir_depth; ++i) {
+        if (strcmp(dir_stack[i], path) != 0) continue;
+        free(dir_stack[i]);
+        memmove(&dir_stack[i], &dir_stack[i + 1], (dir_depth - i - 1) * sizeof(char*));
+        dir_depth--;
+        return;
     }
-    /* null-terminate */
-    arr[n] = NULL;
-    if (out_count) *out_count = n;
-    return arr;
 }
 
-/* ----------- hop implementation ----------- */
-/* Attempt chdir(target). On success update prev_cwd to old_cwd and return 0.
+/* Put 'oldcwd' on top of the directory stack after a move to 'newcwd' */
+static void dir_stack_push(const char *oldcwd, const char *newcwd) {
+    dir_stack_remove(newcwd);
+    dir_stack_remove(oldcwd);
+    if (strcmp(oldcwd, newcwd) == 0) return;
+    char *copy = strdup(oldcwd);
+    if (!copy) return;
+    if (dir_depth == DIRSTACK_MAX) free(dir_stack[--dir_depth]);
+    memmove(&dir_stack[1], &dir_stack[0], dir_depth * sizeof(char*));
+    dir_stack[0] = copy;
+    dir_depth++;
+}
+
+/* Attempt chdir(target). On success update prev_cwd to old_cwd, push it on
+ * the directory stack, record the visit for keyword jumps and return 0.
  * On failure print "No such directory!" and return -1.
  */
 static int do_chdir_and_update_prev(const char *target) {
@@ -265,123 +107,109 @@ static int do_chdir_and_update_prev(const char *target) {
         printf("No such directory!\n");
         return -1;
     }
+    char newcwd[PATH_MAX+1];
+    if (!getcwd(newcwd, sizeof(newcwd))) newcwd[0] = '\0';
     /* update prev */
     if (oldcwd[0] != '\0') {
         strncpy(prev_cwd, oldcwd, sizeof(prev_cwd)-1);
         prev_cwd[sizeof(prev_cwd)-1] = '\0';
         prev_cwd_set = 1;
+        if (newcwd[0] != '\0') dir_stack_push(oldcwd, newcwd);
     }
+    if (newcwd[0] != '\0') frecency_visit(newcwd);
     return 0;
 }
 
-/* Process hop arguments sequentially */
+/* "hop +N": the Nth directory on the stack; "hop +" lists the stack.
+ * Returns -1 if there is no such entry or it cannot be entered. */
+static int hop_stack(const char *a) {
+    if (a[1] == '\0') {
+        for (size_t i = 0; i < dir_depth; ++i) printf("+%zu\t%s\n", i + 1, dir_stack[i]);
+        return 0;
+    }
+    char *end;
+    unsigned long n = strtoul(a + 1, &end, 10);
+    if (*end != '\0' || n == 0 || n > dir_depth) {
+        printf("No such directory!\n");
+        return -1;
+    }
+    /* the stack changes under the hop */
+    char target[PATH_MAX+1];
+    strncpy(target, dir_stack[n - 1], sizeof(target)-1);
+    target[sizeof(target)-1] = '\0';
+    return do_chdir_and_update_prev(target);
+}
+
+/* A bare word that names nothing here: the best match in the frecency
+ * database. Anything that exists (a file, a directory we cannot enter)
+ * fails as a path would. */
+static int hop_name(const char *a) {
+    struct stat st;
+    if (strchr(a, '/') || stat(a, &st) == 0 || errno != ENOENT) {
+        return do_chdir_and_update_prev(a);
+    }
+    char cwd[PATH_MAX+1];
+    char target[PATH_MAX+1];
+    if (frecency_lookup(a, getcwd(cwd, sizeof(cwd)), target, sizeof(target)) != 0) {
+        printf("No such directory!\n");
+        return -1;
+    }
+    return do_chdir_and_update_prev(target);
+}
+
+/* Process hop arguments sequentially. Returns 1, or -1 if any of them
+ * failed (the rest are still tried). */
 int handle_hop_args(char **args, size_t nargs) {
     if (nargs == 0) {
         /* treat as "~" */
         const char *home = getenv("HOME");
         if (!home) {
             printf("No such directory!\n");
-            return 1;
+            return -1;
         }
-        do_chdir_and_update_prev(home);
-        return 1;
+        return do_chdir_and_update_prev(home) == 0 ? 1 : -1;
     }
+    int ret = 1;
     for (size_t i = 0; i < nargs; ++i) {
         const char *a = args[i];
+        int r = 0;
         if (strcmp(a, "~") == 0) {
             const char *home = getenv("HOME");
             if (!home) {
                 printf("No such directory!\n");
-                continue;
+                r = -1;
+            } else {
+                r = do_chdir_and_update_prev(home);
             }
-            do_chdir_and_update_prev(home);
         } else if (strcmp(a, ".") == 0) {
             /* do nothing */
             continue;
         } else if (strcmp(a, "..") == 0) {
-            do_chdir_and_update_prev("..");
+            r = do_chdir_and_update_prev("..");
         } else if (strcmp(a, "-") == 0) {
             if (!prev_cwd_set) {
                 printf("No such directory!\n");
-                continue;
+                r = -1;
+            } else {
+                r = do_chdir_and_update_prev(prev_cwd);
             }
-            do_chdir_and_update_prev(prev_cwd);
+        } else if (a[0] == '+' && (a[1] == '\0' || isdigit((unsigned char)a[1]))) {
+            r = hop_stack(a);
         } else {
-            /* name: relative or absolute path */
-            do_chdir_and_update_prev(a);
+            /* name: relative or absolute path, else a keyword */
+            r = hop_name(a);
         }
+        if (r < 0) ret = -1;
     }
-    return 1;
+    return ret;
 }
 
 /* ----------- reveal implementation ----------- */
 
-static int cmp_str_ascii(const void *a, const void *b) {
-    const char *sa = *(const char * const *)a;
-    const char *sb = *(const char * const *)b;
-    return strcmp(sa, sb); /* strcmp works for ASCII lexicographic order */
-}
-
-/* List directory 'dirpath'. flags: show_all (include .hidden), line_by_line.
- * Returns 1 on handled, 0 on syntax error (prints message), -1 on other error.
- */
-static int list_directory(const char *dirpath, int show_all, int line_by_line) {
-    DIR *d = opendir(dirpath);
-    if (!d) {
-        printf("No such directory!\n");
-        return 1;
-    }
-    struct dirent *ent;
-    size_t cap = 64;
-    size_t n = 0;
-    char **names = malloc(sizeof(char*) * cap);
-    if (!names) { closedir(d); return -1; }
-    while ((ent = readdir(d)) != NULL) {
-        const char *name = ent->d_name;
-        if (!show_all) {
-            if (name[0] == '.') continue;
-        }
-        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
-        if (n + 1 >= cap) {
-            cap *= 2;
-            char **tmp = realloc(names, sizeof(char*) * cap);
-            if (!tmp) break;
-            names = tmp;
-        }
-        names[n++] = strdup(name);
-    }
-    closedir(d);
-    if (n == 0) {
-        /* print empty line */
-        putchar('\n');
-        for (size_t i = 0; i < n; ++i) free(names[i]);
-        free(names);
-        return 1;
-    }
-    /* sort */
-    qsort(names, n, sizeof(char*), cmp_str_ascii);
-    if (line_by_line) {
-        for (size_t i = 0; i < n; ++i) {
-            printf("%s\n", names[i]);
-            free(names[i]);
-        }
-    } else {
-        /* print space-separated on single line */
-        for (size_t i = 0; i < n; ++i) {
-            if (i) putchar(' ');
-            fputs(names[i], stdout);
-            free(names[i]);
-        }
-        putchar('\n');
-    }
-    free(names);
-    return 1;
-}
-
 /* Parse reveal args and dispatch */
 int handle_reveal_args(char **args, size_t nargs) {
-    int show_all = 0;
-    int line_by_line = 0;
+    int flags = 0;
+    int stats = 0;
     char *dir_arg = NULL;
     size_t nonflag_count = 0;
 
@@ -390,12 +218,16 @@ int handle_reveal_args(char **args, size_t nargs) {
         if (t[0] == '-' && t[1] != '\0') {
             /* flags cluster: e.g., -la, -aaaa */
             for (size_t j = 1; t[j]; ++j) {
-                if (t[j] == 'a') show_all = 1;
-                else if (t[j] == 'l') line_by_line = 1;
+                if (t[j] == 'a') flags |= REVEAL_ALL;
+                else if (t[j] == 'l') flags |= REVEAL_LINES;
+                else if (t[j] == 'L') flags |= REVEAL_LONG;
+                else if (t[j] == 'R') flags |= REVEAL_RECURSIVE;
+                else if (t[j] == 's') flags |= REVEAL_SIZES;
+                else if (t[j] == 'C') stats = 1;
                 else {
                     /* invalid flag */
                     printf("reveal: Invalid Syntax!\n");
-                    return 0;
+                    return -1;
                 }
             }
         } else {
@@ -403,33 +235,43 @@ int handle_reveal_args(char **args, size_t nargs) {
             nonflag_count++;
             if (nonflag_count > 1) {
                 printf("reveal: Invalid Syntax!\n");
-                return 0;
+                return -1;
             }
             dir_arg = t;
         }
     }
 
+    /* -C: show the listing cache instead */
+    if (stats) {
+        if (flags || dir_arg) {
+            printf("reveal: Invalid Syntax!\n");
+            return -1;
+        }
+        dircache_print();
+        return 1;
+    }
+
     /* Determine directory path */
     char target[PATH_MAX+1];
     if (!dir_arg) {
         /* default: current working directory */
         if (!getcwd(target, sizeof(target))) {
             printf("No such directory!\n");
-            return 1;
+            return -1;
         }
     } else if (strcmp(dir_arg, "~") == 0) {
         const char *home = getenv("HOME");
-        if (!home) { printf("No such directory!\n"); return 1; }
+        if (!home) { printf("No such directory!\n"); return -1; }
         strncpy(target, home, sizeof(target)-1);
         target[sizeof(target)-1] = '\0';
     } else if (strcmp(dir_arg, ".") == 0) {
-        if (!getcwd(target, sizeof(target))) { printf("No such directory!\n"); return 1; }
+        if (!getcwd(target, sizeof(target))) { printf("No such directory!\n"); return -1; }
     } else if (strcmp(dir_arg, "..") == 0) {
         /* use relative ".." against CWD */
         strncpy(target, "..", sizeof(target)-1);
         target[sizeof(target)-1] = '\0';
     } else if (strcmp(dir_arg, "-") == 0) {
-        if (!prev_cwd_set) { printf("No such directory!\n"); return 1; }
+        if (!prev_cwd_set) { printf("No such directory!\n"); return -1; }
         strncpy(target, prev_cwd, sizeof(target)-1);
         target[sizeof(target)-1] = '\0';
     } else {
@@ -439,17 +281,118 @@ int handle_reveal_args(char **args, size_t nargs) {
     }
 
     /* If dir_arg is ".." or a relative path, we need to form a path relative to cwd.
-     * list_directory() uses opendir(path) which accepts relative paths, so it's okay.
+     * reveal_list() opens the path as given, which accepts relative paths, so it's okay.
      */
-    return list_directory(target, show_all, line_by_line);
+    return reveal_list(target, flags);
 }
 
 /* ----------- log implementation ----------- */
 
 static void print_history_oldest_to_newest(void) {
-    for (size_t i = 0; i < history_count; ++i) {
-        printf("%s\n", history_buf[i]);
+    size_t n = history_count();
+    for (size_t i = 0; i < n; ++i) {
+        size_t len;
+        const char *cmd = history_get(i, &len);
+        if (cmd) printf("%.*s\n", (int)len, cmd);
+    }
+}
+
+typedef struct {
+    const char *text;
+    size_t len;
+    size_t name_len;          /* first word */
+    const HistMeta *meta;
+    double mean;              /* seconds per run */
+} StatRow;
+
+static int cmp_latest_desc(const void *a, const void *b) {
+    long long x = ((const StatRow *)a)->meta->duration_us;
+    long long y = ((const StatRow *)b)->meta->duration_us;
+    return x > y ? -1 : x < y;
+}
+
+/* by command name, then by mean duration */
+static int cmp_name_mean(const void *a, const void *b) {
+    const StatRow *x = a, *y = b;
+    size_t n = x->name_len < y->name_len ? x->name_len : y->name_len;
+    int c = memcmp(x->text, y->text, n);
+    if (c) return c;
+    if (x->name_len != y->name_len) return x->name_len < y->name_len ? -1 : 1;
+    return x->mean < y->mean ? -1 : x->mean > y->mean;
+}
+
+/* Mean duration at percentile p of rows[0..n) (sorted by mean), each row
+ * weighted by its number of runs */
+static double weighted_percentile(const StatRow *rows, size_t n, size_t runs, double p) {
+    double want = p * (double)runs, seen = 0;
+    for (size_t i = 0; i < n; ++i) {
+        seen += (double)rows[i].meta->runs;
+        if (seen >= want) return rows[i].mean;
+    }
+    return n ? rows[n-1].mean : 0;
+}
+
+/* log stats: the slowest commands by their latest run, then per command
+ * name the run count, failure rate, duration percentiles and total time.
+ * Only one entry is kept per distinct line, so the percentiles are over the
+ * lines' mean durations, weighted by how often each ran.
+ */
+static void print_log_stats(void) {
+    size_t count = history_count();
+    StatRow *rows = malloc((count ? count : 1) * sizeof(StatRow));
+    if (!rows) return;
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const HistMeta *m = history_get_meta(i);
+        if (!m) continue;
+        StatRow *r = &rows[n];
+        r->text = history_get(i, &r->len);
+        if (!r->text) continue;
+        r->name_len = 0;
+        while (r->name_len < r->len && r->text[r->name_len] != ' ' &&
+               r->text[r->name_len] != '\t') r->name_len++;
+        r->meta = m;
+        r->mean = (double)m->total_us / 1e6 / (double)m->runs;
+        n++;
+    }
+    if (n == 0) {
+        printf("No timed commands\n");
+        free(rows);
+        return;
+    }
+
+    qsort(rows, n, sizeof(StatRow), cmp_latest_desc);
+    printf("Slowest commands (latest run):\n");
+    for (size_t i = 0; i < n && i < 10; ++i) {
+        const HistMeta *m = rows[i].meta;
+        printf("%10.3fs  ", m->duration_us < 0 ? 0.0 : (double)m->duration_us / 1e6);
+        if (m->status >= 0) printf("exit %-3d  ", m->status);
+        else printf("exit ?    ");
+        printf("%.*s  (in %.*s)\n", (int)rows[i].len, rows[i].text, (int)m->cwd_len,
+               m->cwd ? m->cwd : "?");
     }
+
+    qsort(rows, n, sizeof(StatRow), cmp_name_mean);
+    printf("\n%-16s %7s %6s %9s %9s %9s %10s\n", "command", "runs", "fail%", "p50", "p90",
+           "p99", "total");
+    for (size_t i = 0; i < n;) {
+        size_t j = i, runs = 0, fails = 0;
+        long long total = 0;
+        while (j < n && rows[j].name_len == rows[i].name_len &&
+               memcmp(rows[j].text, rows[i].text, rows[i].name_len) == 0) {
+            runs += rows[j].meta->runs;
+            fails += rows[j].meta->failures;
+            total += rows[j].meta->total_us;
+            j++;
+        }
+        printf("%-16.*s %7zu %5.1f%% %8.3fs %8.3fs %8.3fs %9.3fs\n",
+               (int)rows[i].name_len, rows[i].text, runs, 100.0 * (double)fails / (double)runs,
+               weighted_percentile(rows + i, j - i, runs, 0.50),
+               weighted_percentile(rows + i, j - i, runs, 0.90),
+               weighted_percentile(rows + i, j - i, runs, 0.99), (double)total / 1e6);
+        i = j;
+    }
+    free(rows);
 }
 
 /* handle log command. out_reexec_cmd will be set if we need to re-execute; caller will free.
@@ -463,15 +406,54 @@ int handle_log_args(char **args, size_t nargs, char **out_reexec_cmd) {
     }
     if (nargs == 1) {
         if (strcmp(args[0], "purge") == 0) {
-            /* clear */
-            free_history_in_memory();
-            /* persist */
-            save_history_to_file();
+            /* clear, leaving an empty journal behind */
+            history_purge();
+            return 1;
+        } else if (strcmp(args[0], "size") == 0) {
+            printf("%zu\n", history_get_max());
+            return 1;
+        } else if (strcmp(args[0], "stats") == 0) {
+            print_log_stats();
             return 1;
         } else {
             printf("log: Invalid Syntax!\n");
-            return 1;
+            return -1;
+        }
+    }
+    if (nargs == 2 && strcmp(args[0], "size") == 0) {
+        char *endptr = NULL;
+        long n = strtol(args[1], &endptr, 10);
+        if (endptr == args[1] || *endptr != '\0' || n <= 0) {
+            printf("log: Invalid Syntax!\n");
+            return -1;
         }
+        history_set_max((size_t)n);
+        return 1;
+    }
+    /* "log search <text...>": the words are joined with single spaces */
+    if (nargs >= 2 && strcmp(args[0], "search") == 0) {
+        size_t qlen = 0;
+        for (size_t i = 1; i < nargs; ++i) qlen += strlen(args[i]) + 1;
+        char *q = malloc(qlen);
+        if (!q) return -1;
+        q[0] = '\0';
+        for (size_t i = 1; i < nargs; ++i) {
+            if (i > 1) strcat(q, " ");
+            strcat(q, args[i]);
+        }
+        size_t count = history_count();
+        size_t *pos = malloc((count ? count : 1) * sizeof(size_t));
+        if (!pos) { free(q); return -1; }
+        size_t n = history_search(q, strlen(q), pos, count);
+        /* newest first, numbered as 'log execute' expects */
+        for (size_t i = 0; i < n; ++i) {
+            size_t len;
+            const char *cmd = history_get(pos[i], &len);
+            if (cmd) printf("%4zu  %.*s\n", count - pos[i], (int)len, cmd);
+        }
+        free(pos);
+        free(q);
+        return 1;
     }
     /* Allow "log execute <index>" possibly followed by more tokens (e.g. pipes).
      * If there are trailing tokens, compose a new command string:
@@ -484,38 +466,40 @@ int handle_log_args(char **args, size_t nargs, char **out_reexec_cmd) {
         long idx = strtol(args[1], &endptr, 10);
         if (endptr == args[1] || *endptr != '\0' || idx <= 0) {
             printf("log: Invalid Syntax!\n");
-            return 1;
+            return -1;
         }
         /* index is 1-based newest->oldest */
-        if (history_count == 0) {
+        size_t count = history_count();
+        if (count == 0) {
             printf("log: Invalid Syntax!\n");
-            return 1;
+            return -1;
         }
-        if ((size_t)idx > history_count) {
+        if ((size_t)idx > count) {
             printf("log: Invalid Syntax!\n");
-            return 1;
+            return -1;
         }
-        size_t pos = history_count - (size_t)idx; /* newest -> index 1 */
-        const char *stored_cmd = history_buf[pos];
+        size_t pos = count - (size_t)idx; /* newest -> index 1 */
+        size_t stored_len;
+        const char *stored_cmd = history_get(pos, &stored_len);
         if (!stored_cmd) {
             printf("log: Invalid Syntax!\n");
-            return 1;
+            return -1;
         }
         /* If there are no trailing tokens, just return the stored command. */
         if (nargs == 2) {
-            *out_reexec_cmd = strdup(stored_cmd);
+            *out_reexec_cmd = strndup(stored_cmd, stored_len);
             if (!*out_reexec_cmd) return -1;
             return 2;
         }
         /* Build "<stored_cmd> <args[2]> <args[3]> ..." */
-        size_t needed = strlen(stored_cmd) + 1; /* for possible space and NUL */
+        size_t needed = stored_len + 1; /* for possible space and NUL */
         for (size_t i = 2; i < nargs; ++i) {
             needed += strlen(args[i]) + 1; /* space or terminator */
         }
         char *buf = malloc(needed);
         if (!buf) return -1;
-        buf[0] = '\0';
-        strcat(buf, stored_cmd);
+        memcpy(buf, stored_cmd, stored_len);
+        buf[stored_len] = '\0';
         for (size_t i = 2; i < nargs; ++i) {
             strcat(buf, " ");
             strcat(buf, args[i]);
@@ -525,44 +509,88 @@ int handle_log_args(char **args, size_t nargs, char **out_reexec_cmd) {
     }
     /* anything else is syntax error */
     printf("log: Invalid Syntax!\n");
-    return 1;
+    return -1;
 }
 
-/* Top-level handle function */
-int intrinsics_handle(const char *line, char **out_reexec_cmd) {
-    if (!line) return 0;
-    size_t ntoks = 0;
-    char **toks = tokenize_whitespace(line, &ntoks);
-    if (!toks) return 0;
+/* Build the argument list for "log execute <n> ..." when the atomic is
+ * followed by more of the line (pipes, redirections, further commands).
+ * Everything after the index is passed as extra arguments so that
+ * handle_log_args() appends it to the stored command.
+ * The array and the trailing text live in the line arena; the other
+ * strings are borrowed from the tree. Returns NULL on allocation failure.
+ */
+static char **build_log_execute_args(const CmdLine *cl, size_t *out_nargs) {
+    const CmdNode *node = &cl->groups[0].cmds[0];
+    size_t cap = node->argc + 6;
+    char **args = arena_alloc(line_arena(), sizeof(char*) * cap);
+    if (!args) return NULL;
+    size_t n = 0;
+    for (size_t i = 1; i < node->argc; ++i) args[n++] = node->argv[i];
+    if (node->infile) {
+        args[n++] = "<";
+        args[n++] = node->infile;
+    }
+    if (node->outfile) {
+        args[n++] = node->append ? ">>" : ">";
+        args[n++] = node->outfile;
+    }
+    /* the rest of the line after this atomic: "| grep x", "; ls", "&" ... */
+    const char *tail = cl->src + node->src_end;
+    while (*tail && isspace((unsigned char)*tail)) ++tail;
+    if (*tail) {
+        size_t len = strlen(tail);
+        while (len > 0 && isspace((unsigned char)tail[len - 1])) --len;
+        args[n] = arena_strndup(line_arena(), tail, len);
+        if (!args[n]) return NULL;
+        n++;
+    }
+    args[n] = NULL;
+    *out_nargs = n;
+    return args;
+}
 
-    if (ntoks == 0) { free(toks); return 0; }
+/* Top-level handle function */
+int intrinsics_handle(const CmdLine *cl, char **out_reexec_cmd) {
+    if (!cl || cl->ngroups == 0) return 0;
+
+    const CmdGroup *grp = &cl->groups[0];
+    const CmdNode *node = &grp->cmds[0];
+    const char *cmd = node->argv[0];
+
+    /* "log execute <n>" splices the rest of the line onto the stored command */
+    if (strcmp(cmd, "log") == 0 && node->argc >= 2 &&
+        strcmp(node->argv[1], "execute") == 0) {
+        size_t nargs = 0;
+        char **args = build_log_execute_args(cl, &nargs);
+        if (!args) return -1;
+        int res = handle_log_args(args, nargs, out_reexec_cmd);
+        if (res == -1) return -1;
+        return res; /* 1 or 2 */
+    }
 
-    /* determine first token (command name) */
-    const char *cmd = toks[0];
+    /* Other intrinsics run in the shell only as a lone foreground atomic;
+     * anything more complex goes through exec_run_parsed().
+     */
+    if (cl->ngroups != 1 || grp->ncmds != 1 || grp->background ||
+        node->infile || node->outfile) {
+        return 0;
+    }
 
     if (strcmp(cmd, "hop") == 0) {
-        /* hop: arguments are tokens[1..] */
-        int res = handle_hop_args(&toks[1], ntoks > 0 ? ntoks - 1 : 0);
-        for (size_t i = 0; i < ntoks; ++i) free(toks[i]);
-        free(toks);
+        /* hop: arguments are argv[1..] */
+        int res = handle_hop_args(&node->argv[1], node->argc - 1);
         if (res < 0) return -1;
         return 1;
     } else if (strcmp(cmd, "reveal") == 0) {
-        int res = handle_reveal_args(&toks[1], ntoks > 0 ? ntoks - 1 : 0);
-        for (size_t i = 0; i < ntoks; ++i) free(toks[i]);
-        free(toks);
+        int res = handle_reveal_args(&node->argv[1], node->argc - 1);
         if (res < 0) return -1;
         return 1;
     } else if (strcmp(cmd, "log") == 0) {
-        int res = handle_log_args(&toks[1], ntoks > 0 ? ntoks - 1 : 0, out_reexec_cmd);
-        for (size_t i = 0; i < ntoks; ++i) free(toks[i]);
-        free(toks);
+        int res = handle_log_args(&node->argv[1], node->argc - 1, out_reexec_cmd);
         if (res == -1) return -1;
         return res; /* 1 or 2 */
     }
 
     /* not an intrinsic */
-    for (size_t i = 0; i < ntoks; ++i) free(toks[i]);
-    free(toks);
     return 0;
 }
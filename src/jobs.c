@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bg_job *job_list = NULL;
+static int next_job_id = 1;
+
+/* Integer key -> (pointer, index) map. Open addressing with linear
+ * probing; key 0 marks an empty slot and -1 a deleted one, so only
+ * positive keys (job ids, pids) can be stored.
+ */
+typedef struct {
+    int key;
+    void *val;
+    size_t aux;
+} IntSlot;
+
+typedef struct {
+    IntSlot *slots;
+    size_t cap;    /* power of two */
+    size_t used;   /* live + deleted slots */
+    size_t count;  /* live slots */
+} IntMap;
+
+static IntMap id_map;   /* job id -> job */
+static IntMap pid_map;  /* stage pid -> (job, stage index) */
+
+static size_t int_hash(const IntMap *m, int key) {
+    return ((size_t)(unsigned)key * 2654435761u) & (m->cap - 1);
+}
+
+static int intmap_resize(IntMap *m, size_t ncap) {
+    IntSlot *t = calloc(ncap, sizeof(IntSlot));
+    if (!t) return -1;
+    IntSlot *old = m->slots;
+    size_t ocap = m->cap;
+    m->slots = t;
+    m->cap = ncap;
+    m->used = 0;
+    for (size_t i = 0; i < ocap; ++i) {
+        if (old[i].key <= 0) continue;
+        size_t h = int_hash(m, old[i].key);
+        while (m->slots[h].key != 0) h = (h + 1) & (m->cap - 1);
+        m->slots[h] = old[i];
+        m->used++;
+    }
+    free(old);
+    return 0;
+}
+
+/* Returns 0, or -1 if the map could not grow (nothing stored) */
+static int intmap_put(IntMap *m, int key, void *val, size_t aux) {
+    if ((m->used + 1) * 2 > m->cap) {
+        /* mostly tombstones: rehash in place instead of doubling */
+        size_t ncap = m->cap ? m->cap : 64;
+        if ((m->count + 1) * 4 > ncap) ncap *= 2;
+        if (intmap_resize(m, ncap) != 0) return -1;
+    }
+    size_t h = int_hash(m, key);
+    while (m->slots[h].key > 0) h = (h + 1) & (m->cap - 1);
+    if (m->slots[h].key == 0) m->used++;
+    m->slots[h].key = key;
+    m->slots[h].val = val;
+    m->slots[h].aux = aux;
+    m->count++;
+    return 0;
+}
+
+static IntSlot *intmap_get(const IntMap *m, int key) {
+    if (m->cap == 0 || key <= 0) return NULL;
+    size_t h = int_hash(m, key);
+    while (m->slots[h].key != 0) {
+        if (m->slots[h].key == key) return &m->slots[h];
+        h = (h + 1) & (m->cap - 1);
+    }
+    return NULL;
+}
+
+static void intmap_del(IntMap *m, int key, const void *val) {
+    IntSlot *s = intmap_get(m, key);
+    if (s && s->val == val) {
+        s->key = -1;
+        m->count--;
+    }
+}
+
+static void intmap_free(IntMap *m) {
+    free(m->slots);
+    memset(m, 0, sizeof(*m));
+}
+
+/* Treap of live stages ordered by (name, pid): the 'activities' view.
+ * Heap order on random priorities keeps the expected depth logarithmic.
+ */
+static bg_stage *by_name = NULL;
+
+static unsigned next_prio(void) {
+    static unsigned x = 2463534242u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static int stage_cmp(const bg_stage *a, const bg_stage *b) {
+    int c = strcmp(a->name, b->name);
+    if (c != 0) return c;
+    return (a->pid > b->pid) - (a->pid < b->pid);
+}
+
+static bg_stage *treap_insert(bg_stage *root, bg_stage *st) {
+    if (!root) return st;
+    if (stage_cmp(st, root) < 0) {
+        root->left = treap_insert(root->left, st);
+        if (root->left->prio > root->prio) {
+            bg_stage *l = root->left;
+            root->left = l->right;
+            l->right = root;
+            return l;
+        }
+    } else {
+        root->right = treap_insert(root->right, st);
+        if (root->right->prio > root->prio) {
+            bg_stage *r = root->right;
+            root->right = r->left;
+            r->left = root;
+            return r;
+        }
+    }
+    return root;
+}
+
+static bg_stage *treap_merge(bg_stage *a, bg_stage *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->prio > b->prio) {
+        a->right = treap_merge(a->right, b);
+        return a;
+    }
+    b->left = treap_merge(a, b->left);
+    return b;
+}
+
+static bg_stage *treap_remove(bg_stage *root, bg_stage *st) {
+    if (!root) return NULL;
+    if (root == st) {
+        bg_stage *r = treap_merge(st->left, st->right);
+        st->left = st->right = NULL;
+        return r;
+    }
+    if (stage_cmp(st, root) < 0) root->left = treap_remove(root->left, st);
+    else root->right = treap_remove(root->right, st);
+    return root;
+}
+
+static void treap_walk(const bg_stage *n, void (*fn)(const bg_stage *, void *), void *arg) {
+    while (n) {
+        treap_walk(n->left, fn, arg);
+        fn(n, arg);
+        n = n->right;
+    }
+}
+
+bg_job *jobs_new(pid_t pgid, const pid_t *pids, char *const *names, size_t n,
+                 const char *cmd, int stopped) {
+    bg_job *job = calloc(1, sizeof(bg_job));
+    if (!job) return NULL;
+    job->stages = calloc(n ? n : 1, sizeof(bg_stage));
+    job->command = strdup(cmd);
+    if (!job->stages || !job->command) { jobs_free(job); return NULL; }
+    job->nstages = n;
+    for (size_t i = 0; i < n; ++i) {
+        bg_stage *st = &job->stages[i];
+        st->job = job;
+        st->prio = next_prio();
+        st->pid = pids[i] > 0 ? pids[i] : -1;
+        st->stopped = stopped;
+        st->name = strdup(names[i]);
+        if (!st->name) { jobs_free(job); return NULL; }
+        if (st->pid > 0) job->nlive++;
+    }
+    job->pid = pgid;
+    /* a last stage that never started counts as an abnormal exit */
+    job->status = (n && pids[n - 1] > 0) ? 0 : 1 << 8;
+    job->stopped = stopped;
+    return job;
+}
+
+int jobs_add(bg_job *job) {
+    job->job_id = next_job_id;
+    if (intmap_put(&id_map, job->job_id, job, 0) != 0) return -1;
+    for (size_t i = 0; i < job->nstages; ++i) {
+        bg_stage *st = &job->stages[i];
+        if (st->pid <= 0 || intmap_put(&pid_map, st->pid, job, i) == 0) continue;
+        /* a stage missing from pid_map would never be reaped into the job */
+        while (i-- > 0) {
+            if (job->stages[i].pid > 0) intmap_del(&pid_map, job->stages[i].pid, job);
+        }
+        intmap_del(&id_map, job->job_id, job);
+        return -1;
+    }
+    next_job_id++;
+    job->prev = NULL;
+    job->next = job_list;
+    if (job_list) job_list->prev = job;
+    job_list = job;
+    for (size_t i = 0; i < job->nstages; ++i) {
+        bg_stage *st = &job->stages[i];
+        if (st->pid > 0) by_name = treap_insert(by_name, st);
+    }
+    return 0;
+}
+
+void jobs_remove(bg_job *job) {
+    if (job->prev) job->prev->next = job->next; else job_list = job->next;
+    if (job->next) job->next->prev = job->prev;
+    job->next = job->prev = NULL;
+    intmap_del(&id_map, job->job_id, job);
+    for (size_t i = 0; i < job->nstages; ++i) {
+        bg_stage *st = &job->stages[i];
+        if (st->pid <= 0) continue;
+        intmap_del(&pid_map, st->pid, job);
+        by_name = treap_remove(by_name, st);
+    }
+}
+
+void jobs_free(bg_job *job) {
+    for (size_t i = 0; i < job->nstages; ++i) free(job->stages[i].name);
+    free(job->stages);
+    free(job->command);
+    free(job);
+}
+
+bg_job *jobs_find(int job_id) {
+    IntSlot *s = intmap_get(&id_map, job_id);
+    return s ? s->val : NULL;
+}
+
+bg_job *jobs_find_pid(pid_t pid, size_t *stage) {
+    IntSlot *s = intmap_get(&pid_map, pid);
+    if (!s) return NULL;
+    if (stage) *stage = s->aux;
+    return s->val;
+}
+
+void jobs_stage_done(bg_job *job, size_t i) {
+    bg_stage *st = &job->stages[i];
+    if (st->pid <= 0) return;
+    intmap_del(&pid_map, st->pid, job);
+    by_name = treap_remove(by_name, st);
+    st->pid = -1;
+    job->nlive--;
+}
+
+void jobs_foreach_stage(void (*fn)(const bg_stage *st, void *arg), void *arg) {
+    treap_walk(by_name, fn, arg);
+}
+
+void jobs_clear(void) {
+    bg_job *cur = job_list;
+    while (cur) {
+        bg_job *tmp = cur;
+        cur = cur->next;
+        jobs_free(tmp);
+    }
+    job_list = NULL;
+    by_name = NULL;
+    intmap_free(&id_map);
+    intmap_free(&pid_map);
+    next_job_id = 1;
+}
@@ -5,79 +5,543 @@
 #include <errno.h>
 #include <unistd.h>
 #include <termios.h>
+#include <poll.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "prompt.h"
 #include "parser.h"
 #include "intrinsics.h"
 #include "exec.h"
+#include "arena.h"
+#include "pathcache.h"
+#include "dircache.h"
+#include "queue.h"
+#include "history.h"
+#include "input.h"
+#include "dagrun.h"
 
 /* Save original terminal attributes so we can restore on exit */
 static struct termios g_orig_termios;
 static int g_termios_saved = 0;
+/* bracketed paste is only requested from a terminal */
+static int paste_enabled = 0;
+static int paste_on = 0;
 
 static void restore_terminal_mode(void) {
+    if (paste_on) {
+        /* exiting from the middle of a line leaves it on */
+        write(STDOUT_FILENO, "\033[?2004l", 8);
+        paste_on = 0;
+    }
     if (g_termios_saved) {
         tcsetattr(STDIN_FILENO, TCSANOW, &g_orig_termios);
         g_termios_saved = 0;
     }
 }
 
+/* Block until stdin has input. Background jobs that finish meanwhile are
+ * reported right away, after which the prompt and the partial line are
+ * redrawn.
+ */
+static void wait_for_input(const char *buf, size_t len) {
+    int chld_fd = exec_sigchld_fd();
+    if (chld_fd < 0) return;
+    while (1) {
+        struct pollfd pfds[2];
+        pfds[0].fd = STDIN_FILENO;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = chld_fd;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        /* queued entries held back by the load limit need a re-check */
+        int pres = poll(pfds, 2, queue_poll_timeout());
+        if (pres < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (pfds[0].revents) return;
+        if ((pres == 0 || (pfds[1].revents & POLLIN)) && check_background_jobs() > 0) {
+            prompt_print();
+            if (len > 0) write(STDOUT_FILENO, buf, len);
+        }
+    }
+}
+
+/* Incremental reverse search (Ctrl-R) over the history. Typing extends the
+ * query, Backspace shortens it, Ctrl-R steps to the next older match.
+ * Enter accepts the match as the line (returns 1); any other control key
+ * puts it into the line for editing and Ctrl-G/Esc restore the line as it
+ * was (both return 0). Each step searches only the entries older than the
+ * match shown. Returns -1 on allocation failure.
+ */
+static int reverse_search(char **bufp, size_t *lenp, size_t *capp) {
+    char q[256];
+    size_t qlen = 0;
+    size_t match = 0;
+    int have = 0, failed = 0;
+    int accept = 0;
+
+    while (1) {
+        size_t mlen = 0;
+        const char *m = have ? history_get(match, &mlen) : NULL;
+        printf("\r\033[K(%sreverse-i-search)`%.*s': %.*s", failed ? "failed " : "",
+               (int)qlen, q, (int)mlen, m ? m : "");
+        fflush(stdout);
+
+        int c = input_getc();
+        if (c < 0 || c == 7 || c == 27 || c == 4) break;
+        if (c == '\r' || c == '\n') { accept = 1; break; }
+        /* a new query starts over at the newest entry, Ctrl-R goes on
+         * from the match shown */
+        size_t before = history_count();
+        if (c == 18) {
+            if (qlen == 0) continue;
+            if (have) before = match;
+        } else if (c == 127 || c == '\b') {
+            if (qlen > 0) qlen--;
+        } else if (c >= 32) {
+            if (qlen < sizeof(q)) q[qlen++] = (char)c;
+        } else {
+            accept = -1;   /* edit the match */
+            break;
+        }
+        if (qlen == 0) { have = failed = 0; continue; }
+        size_t found;
+        if (history_search_older(q, qlen, before, &found)) {
+            match = found;
+            have = 1;
+            failed = 0;
+        } else {
+            /* keep showing the last match found */
+            failed = 1;
+        }
+    }
+
+    if (accept && have) {
+        size_t mlen = 0;
+        const char *m = history_get(match, &mlen);
+        if (m) {
+            if (mlen + 1 > *capp) {
+                char *t = realloc(*bufp, mlen + 1);
+                if (!t) return -1;
+                *bufp = t;
+                *capp = mlen + 1;
+            }
+            memcpy(*bufp, m, mlen);
+            *lenp = mlen;
+        }
+    }
+    /* back to the normal prompt */
+    printf("\r\033[K");
+    prompt_print();
+    if (*lenp > 0) write(STDOUT_FILENO, *bufp, *lenp);
+    return accept == 1;
+}
+
+/* Echo is collected here and written once per batch of input */
+static char echo_buf[4096];
+static size_t echo_len = 0;
+
+static void echo_flush(void) {
+    if (echo_len > 0) write(STDOUT_FILENO, echo_buf, echo_len);
+    echo_len = 0;
+}
+
+static void echo(const char *p, size_t n) {
+    if (echo_len + n > sizeof(echo_buf)) echo_flush();
+    if (n >= sizeof(echo_buf)) {
+        write(STDOUT_FILENO, p, n);
+        return;
+    }
+    memcpy(echo_buf + echo_len, p, n);
+    echo_len += n;
+}
+
+/* Bracketed paste: the terminal wraps pasted text in these markers */
+static const char PASTE_START[] = "\033[200~";
+static const char PASTE_END[] = "\033[201~";
+#define PASTE_MARK_LEN 6
+/* inside a paste; it may span several lines */
+static int in_paste = 0;
+
+/* Input starts with ESC: consume a paste marker if that is what follows.
+ * Returns 1 if one was consumed, 0 if the ESC is an ordinary byte.
+ */
+static int take_paste_marker(void) {
+    char seq[PASTE_MARK_LEN];
+    size_t have = input_copy(seq, PASTE_MARK_LEN);
+    /* the rest of a marker arrives right behind the ESC */
+    while (have < PASTE_MARK_LEN && memcmp(seq, PASTE_START, have) == 0 &&
+           input_fill_timeout(50) > 0) {
+        have = input_copy(seq, PASTE_MARK_LEN);
+    }
+    if (have < PASTE_MARK_LEN) return 0;
+    if (memcmp(seq, PASTE_START, PASTE_MARK_LEN) == 0) in_paste = 1;
+    else if (memcmp(seq, PASTE_END, PASTE_MARK_LEN) == 0) in_paste = 0;
+    else return 0;
+    input_consume(PASTE_MARK_LEN);
+    return 1;
+}
+
+static int line_append(char **bufp, size_t *lenp, size_t *capp, const char *p, size_t n) {
+    if (*lenp + n + 1 > *capp) {
+        size_t ncap = *capp * 2;
+        while (*lenp + n + 1 > ncap) ncap *= 2;
+        char *t = realloc(*bufp, ncap);
+        if (!t) return -1;
+        *bufp = t;
+        *capp = ncap;
+    }
+    memcpy(*bufp + *lenp, p, n);
+    *lenp += n;
+    return 0;
+}
+
 /* Read one line in non-canonical mode. Returns malloc'd string (without newline).
  * On Ctrl-D (EOT) this function will call handle_eof_exit() and not return.
  * Returns NULL only on unrecoverable error (but handle_eof_exit will normally exit).
+ *
+ * Input is taken from the shell's input buffer a batch at a time: runs of
+ * ordinary characters (and whole pasted blocks) are copied into the line
+ * at once and their echo goes out in one write() per batch. Bytes after
+ * the newline stay buffered for the next line.
  */
 static char *read_input_line(void) {
     size_t cap = 256;
     size_t len = 0;
     char *buf = malloc(cap);
     if (!buf) return NULL;
+    if (paste_enabled) {
+        write(STDOUT_FILENO, "\033[?2004h", 8);
+        paste_on = 1;
+    }
 
-    while (1) {
-        char c;
-        ssize_t r = read(STDIN_FILENO, &c, 1);
-        if (r <= 0) {
-            /* EOF or error on read -> treat as EOF */
-            free(buf);
-            handle_eof_exit(); /* does not return */
-            return NULL;
+    int done = 0;
+    while (!done) {
+        if (input_pending() == 0) {
+            echo_flush();
+            wait_for_input(buf, len);
+            if (input_fill() <= 0) {
+                /* EOF or error on read -> treat as EOF */
+                free(buf);
+                handle_eof_exit(); /* does not return */
+                return NULL;
+            }
+        }
+        const char *p;
+        size_t n = input_peek(&p);
+        size_t i = 0;
+        int special = 0;
+        while (i < n) {
+            /* a run of bytes that go into the line as they are; pasted
+             * text keeps its control characters */
+            size_t j = i;
+            if (in_paste) {
+                while (j < n && p[j] != '\033' && p[j] != '\r' && p[j] != '\n') j++;
+            } else {
+                while (j < n && (unsigned char)p[j] >= 32 && p[j] != 127 && p[j] != '\033') j++;
+            }
+            if (j > i) {
+                if (line_append(&buf, &len, &cap, p + i, j - i) != 0) { free(buf); return NULL; }
+                echo(p + i, j - i);
+                i = j;
+                continue;
+            }
+            char c = p[i];
+            if (c == '\r' || c == '\n') {
+                /* echo newline and finish */
+                echo("\n", 1);
+                i++;
+                done = 1;
+                break;
+            }
+            if (c == 127 || c == '\b') {
+                /* backspace: remove last char if any and erase on terminal */
+                if (len > 0) {
+                    len--;
+                    echo("\b \b", 3);
+                }
+                i++;
+                continue;
+            }
+            /* Ctrl-D, Ctrl-R and ESC are handled on the buffer itself */
+            special = 1;
+            break;
         }
+        input_consume(i);
+        if (done || !special) continue;
+
+        echo_flush();
+        char c;
+        input_copy(&c, 1);
+        /* a paste marker switches modes; a lone ESC is an ordinary byte */
+        if (c == 27 && take_paste_marker()) continue;
+        input_consume(1);
         if ((unsigned char)c == 4) { /* Ctrl-D (EOT) */
             free(buf);
             handle_eof_exit(); /* does not return */
             return NULL;
         }
-        if (c == '\r' || c == '\n') {
-            /* echo newline and finish */
-            const char nl = '\n';
-            write(STDOUT_FILENO, &nl, 1);
-            break;
-        }
-        if (c == 127 || c == '\b') {
-            /* backspace: remove last char if any and erase on terminal */
-            if (len > 0) {
-                const char bs_seq[] = { '\b', ' ', '\b' };
-                len--;
-                write(STDOUT_FILENO, bs_seq, sizeof(bs_seq));
+        if (c == 18) { /* Ctrl-R */
+            int rs = reverse_search(&buf, &len, &cap);
+            if (rs < 0) { free(buf); return NULL; }
+            if (rs == 1) {
+                echo("\n", 1);
+                done = 1;
             }
             continue;
         }
-        /* ordinary character: append and echo */
-        if (len + 1 >= cap) {
-            size_t ncap = cap * 2;
-            char *t = realloc(buf, ncap);
-            if (!t) { free(buf); return NULL; }
-            buf = t; cap = ncap;
-        }
-        buf[len++] = c;
-        write(STDOUT_FILENO, &c, 1);
+        /* any other control character: append and echo */
+        if (line_append(&buf, &len, &cap, &c, 1) != 0) { free(buf); return NULL; }
+        echo(&c, 1);
+    }
+    echo_flush();
+    if (paste_on) {
+        write(STDOUT_FILENO, "\033[?2004l", 8);
+        paste_on = 0;
     }
     /* Null-terminate and return */
     buf[len] = '\0';
     return buf;
 }
 
-int main(void) {
+/* Parse and run one line: intrinsics first, then normal execution.
+ * Interactive lines (src == NULL) are recorded in history; script lines
+ * are not, and their syntax errors carry "src:lineno:". Returns the
+ * line's exit status (2 for invalid syntax).
+ */
+static int run_line(const char *line, const char *src, size_t lineno) {
+    /* Parse once per Part A grammar; the tree is shared by history,
+     * intrinsics and execution */
+    CmdLine *cl = parse_command_line(line_arena(), line);
+    if (!cl) {
+        if (src) fprintf(stderr, "%s:%zu: Invalid Syntax!\n", src, lineno);
+        else printf("Invalid Syntax!\n");
+        return 2;
+    }
+
+    /* Record the user's command in history (intrinsics_record_command
+     * will skip storing if the command contains atomic 'log' or it is a
+     * duplicate of the previous entry). Do this BEFORE handling intrinsics.
+     * Note: when log execute returns a command to re-executed, do NOT call
+     * intrinsics_record_command on that re-executed command (spec requirement).
+     */
+    if (!src) intrinsics_record_command(line, cl);
+
+    /* Try to handle intrinsics.
+     * If intrinsics_handle returns 0 -> not an intrinsic (Part C will execute)
+     * If it returns 1 -> intrinsic handled, nothing more to do
+     * If it returns 2 -> intrinsic handled and provided a command to re-execute:
+     *                    out_reexec_cmd contains malloc'd string that MUST be free()'d
+     *                    and MUST NOT be recorded in history by the caller.
+     */
+    char *reexec = NULL;
+    int hres = intrinsics_handle(cl, &reexec);
+    if (hres == 0) {
+        /* Not an intrinsic: execute the line (normal execution path). */
+        exec_run_parsed(cl);
+        return exec_last_status();
+    } else if (hres == 1) {
+        /* handled, nothing more to do */
+        return 0;
+    } else if (hres == -1) {
+        /* error already printed by intrinsics: the line failed, and is
+         * journaled with that status */
+        return 1;
+    }
+
+    /* hres == 2: intrinsics wants us to re-execute a stored command (log
+     * execute). We must NOT record the re-executed command. Handle it now.
+     *
+     * The reexec returned by intrinsics_handle is malloc'd; we will
+     * free it (and any nested reexecs) here.
+     *
+     * Strategy:
+     *  - parse reexec (this also validates it)
+     *  - try to handle it as an intrinsic (intrinsics_handle) WITHOUT recording
+     *  - if not an intrinsic, execute via exec_run_parsed()
+     *  - if intrinsics_handle returns yet another reexec (nested), follow it
+     *    until a terminal action occurs.
+     */
+    int status = 0;
+    char *current = reexec;      /* takes ownership */
+    reexec = NULL;
+    while (current) {
+        /* Validate before doing anything */
+        CmdLine *ccl = parse_command_line(line_arena(), current);
+        if (!ccl) {
+            printf("Invalid Syntax!\n");
+            status = 2;
+            free(current);
+            current = NULL;
+            break;
+        }
+
+        /* Try intrinsic handler on the reexec command (do NOT record) */
+        char *next_reexec = NULL;
+        int nested = intrinsics_handle(ccl, &next_reexec);
+        if (nested == 2) {
+            /* got another reexec; free current and follow chain */
+            free(current);
+            current = next_reexec; /* take ownership and loop */
+            next_reexec = NULL;
+            continue;
+        } else if (nested == 0) {
+            /* not an intrinsic -> execute it (do NOT record) */
+            exec_run_parsed(ccl);
+            status = exec_last_status();
+        } else if (nested == -1) {
+            /* intrinsics printed error */
+            status = 1;
+        }
+        free(current);
+        current = NULL;
+    }
+    return status;
+}
+
+/* Script lines are copied here to be NUL-terminated */
+static char *script_line = NULL;
+static size_t script_line_cap = 0;
+
+/* Run every complete line in text[0..len). With 'final' a last line that
+ * lacks its newline runs too. Blank lines and lines starting with '#'
+ * are skipped. Returns the number of bytes consumed.
+ */
+static size_t run_script_lines(const char *text, size_t len, int final, const char *src,
+                               size_t *lineno, int *status) {
+    size_t pos = 0;
+    while (pos < len) {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        if (!nl && !final) break;
+        size_t end = nl ? (size_t)(nl - text) : len;
+        size_t n = end - pos;
+        ++*lineno;
+        if (n > 0 && text[pos + n - 1] == '\r') n--;
+        size_t k = 0;
+        while (k < n && (text[pos + k] == ' ' || text[pos + k] == '\t')) k++;
+        if (k < n && text[pos + k] != '#') {
+            if (n + 1 > script_line_cap) {
+                size_t ncap = script_line_cap ? script_line_cap : 256;
+                while (n + 1 > ncap) ncap *= 2;
+                char *t = realloc(script_line, ncap);
+                if (!t) {
+                    fprintf(stderr, "%s:%zu: line too long\n", src, *lineno);
+                    *status = 1;
+                    return len;
+                }
+                script_line = t;
+                script_line_cap = ncap;
+            }
+            memcpy(script_line, text + pos, n);
+            script_line[n] = '\0';
+            /* everything parsed for the previous line is dead now */
+            arena_reset(line_arena());
+            check_background_jobs();
+            *status = run_line(script_line, src, *lineno);
+        }
+        pos = nl ? end + 1 : len;
+    }
+    return pos;
+}
+
+/* Size of the read buffer for scripts that cannot be mapped (pipes) */
+#define SCRIPT_CHUNK (64 * 1024)
+
+/* Run the script on fd: a regular file is mapped and walked in place,
+ * anything else is read in large chunks. Returns the last line's status.
+ */
+static int run_script_fd(int fd, const char *src) {
+    int status = 0;
+    size_t lineno = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t len = (size_t)st.st_size;
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+            run_script_lines(map, len, 1, src, &lineno, &status);
+            munmap(map, len);
+            return status;
+        }
+    }
+
+    size_t cap = SCRIPT_CHUNK, have = 0;
+    char *buf = malloc(cap);
+    if (!buf) return 1;
+    while (1) {
+        if (cap - have < SCRIPT_CHUNK / 2) {
+            /* a line longer than what is left: grow */
+            char *t = realloc(buf, cap * 2);
+            if (!t) { status = 1; break; }
+            buf = t;
+            cap *= 2;
+        }
+        ssize_t r = read(fd, buf + have, cap - have);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            run_script_lines(buf, have, 1, src, &lineno, &status);
+            break;
+        }
+        have += (size_t)r;
+        size_t used = run_script_lines(buf, have, 0, src, &lineno, &status);
+        memmove(buf, buf + used, have - used);
+        have -= used;
+    }
+    free(buf);
+    return status;
+}
+
+static void shell_cleanup(void) {
+    intrinsics_cleanup();
+    prompt_cleanup();
+    pathcache_cleanup();
+    dircache_cleanup();
+    queue_cleanup();
+    input_cleanup();
+    free(script_line);
+    script_line = NULL;
+    script_line_cap = 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: shell.out [script | - | -c commands | --parallel [-j N] file]\n");
+}
+
+int main(int argc, char **argv) {
+    /* shell.out script / shell.out - (stdin) / shell.out -c "commands" run
+     * without the terminal setup and prompt */
+    const char *script = NULL, *command = NULL, *dagfile = NULL;
+    size_t nslots = 0;
+    if (argc >= 3 && strcmp(argv[1], "--parallel") == 0) {
+        /* --parallel [-j N] file */
+        int i = 2;
+        if (argc == 5 && strcmp(argv[2], "-j") == 0) {
+            char *end;
+            long v = strtol(argv[3], &end, 10);
+            if (*end != '\0' || v < 1) {
+                usage();
+                return 2;
+            }
+            nslots = (size_t)v;
+            i = 4;
+        }
+        if (i != argc - 1) {
+            usage();
+            return 2;
+        }
+        dagfile = argv[i];
+    } else if (argc == 3 && strcmp(argv[1], "-c") == 0) command = argv[2];
+    else if (argc == 2 && (argv[1][0] != '-' || strcmp(argv[1], "-") == 0)) script = argv[1];
+    else if (argc != 1) {
+        usage();
+        return 2;
+    }
+
     if (prompt_init() != 0) {
         fprintf(stderr, "Failed to initialize prompt: %s\n", strerror(errno));
         /* continue anyway; prompt will use defaults */
@@ -87,9 +551,45 @@ int main(void) {
         /* non-fatal */
     }
 
-    char *line = NULL;
-
     init_job_list();
+    queue_init();
+
+    if (dagfile) {
+        exec_set_interactive(0);
+        if (nslots == 0) {
+            long n = sysconf(_SC_NPROCESSORS_ONLN);
+            nslots = n > 0 ? (size_t)n : 1;
+        }
+        int status = dagrun_file(dagfile, nslots);
+        shell_cleanup();
+        return status;
+    }
+
+    if (script || command) {
+        exec_set_interactive(0);
+        int status;
+        if (command) {
+            size_t lineno = 0;
+            status = 0;
+            run_script_lines(command, strlen(command), 1, "-c", &lineno, &status);
+        } else if (strcmp(script, "-") == 0) {
+            status = run_script_fd(STDIN_FILENO, "stdin");
+        } else {
+            int fd = open(script, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                fprintf(stderr, "shell.out: %s: %s\n", script, strerror(errno));
+                shell_cleanup();
+                return 127;
+            }
+            status = run_script_fd(fd, script);
+            close(fd);
+        }
+        fflush(stdout);
+        shell_cleanup();
+        return status;
+    }
+
+    char *line = NULL;
 
     /* Switch terminal to non-canonical mode so Ctrl-D is seen immediately.
      * Save original attributes and register restore handler so that
@@ -104,10 +604,21 @@ int main(void) {
         if (tcsetattr(STDIN_FILENO, TCSANOW, &t) == 0) {
             g_termios_saved = 1;
             atexit(restore_terminal_mode);
+            /* pastes arrive marked, so they can be inserted in one go */
+            paste_enabled = isatty(STDOUT_FILENO);
         }
     }
 
+    /* exit status of the line just run, for its history record */
+    int line_status = 0;
     while (1) {
+        /* the previous line is done: complete its history record */
+        history_finish(line_status);
+        line_status = 0;
+        /* everything parsed for the previous line is dead now */
+        arena_reset(line_arena());
+        /* safe point: report background jobs that finished meanwhile */
+        check_background_jobs();
         prompt_print();
         /* Read a line in non-canonical mode, detect Ctrl-D immediately */
         char *rl = read_input_line();
@@ -130,102 +641,11 @@ int main(void) {
         }
         if (allws) continue;
 
-        /* Validate syntax per Part A grammar */
-        if (!validate_syntax(line)) {
-            printf("Invalid Syntax!\n");
-            continue;
-        }
-
-        /* Record the user's command in history (intrinsics_record_command
-         * will skip storing if the command contains atomic 'log' or it is a
-         * duplicate of the previous entry). Do this BEFORE handling intrinsics.
-         * Note: when log execute returns a command to re-executed, do NOT call
-         * intrinsics_record_command on that re-executed command (spec requirement).
-         */
-        intrinsics_record_command(line);
-
-        /* Try to handle intrinsics.
-         * If intrinsics_handle returns 0 -> not an intrinsic (Part C will execute)
-         * If it returns 1 -> intrinsic handled, continue loop
-         * If it returns 2 -> intrinsic handled and provided a command to re-execute:
-         *                    out_reexec_cmd contains malloc'd string that MUST be free()'d
-         *                    and MUST NOT be recorded in history by the caller.
-         */
-        char *reexec = NULL;
-        int hres = intrinsics_handle(line, &reexec);
-        if (hres == 0) {
-            /* Not an intrinsic: execute the line (normal execution path). */
-            exec_run_line(line);
-            check_background_jobs();
-            continue;
-        } else if (hres == 1) {
-            /* handled, nothing more to do */
-            continue;
-        } else if (hres == 2) {
-            /* intrinsics wants us to re-execute a stored command (log execute).
-             * We must NOT record the re-executed command. Handle it now.
-             *
-             * The reexec returned by intrinsics_handle is malloc'd; we will
-             * free it (and any nested reexecs) here.
-             *
-             * Strategy:
-             *  - validate syntax of reexec
-             *  - try to handle it as an intrinsic (intrinsics_handle) WITHOUT recording
-             *  - if not an intrinsic, execute via exec_run_line()
-             *  - if intrinsics_handle returns yet another reexec (nested), follow it
-             *    until a terminal action occurs.
-             */
-            char *current = reexec;      /* takes ownership */
-            reexec = NULL;
-            while (current) {
-                /* Validate before doing anything */
-                if (!validate_syntax(current)) {
-                    printf("Invalid Syntax!\n");
-                    free(current);
-                    current = NULL;
-                    break;
-                }
-
-                /* Try intrinsic handler on the reexec command (do NOT record) */
-                char *next_reexec = NULL;
-                int nested = intrinsics_handle(current, &next_reexec);
-                if (nested == 1) {
-                    /* intrinsic handled; done */
-                    free(current);
-                    current = NULL;
-                    break;
-                } else if (nested == 2) {
-                    /* got another reexec; free current and follow chain */
-                    free(current);
-                    current = next_reexec; /* take ownership and loop */
-                    next_reexec = NULL;
-                    continue;
-                } else if (nested == 0) {
-                    /* not an intrinsic -> execute it (do NOT record) */
-                    exec_run_line(current);
-                    free(current);
-                    current = NULL;
-                    break;
-                } else {
-                    /* nested == -1 or error: intrinsics printed error; stop */
-                    free(current);
-                    current = NULL;
-                    break;
-                }
-            }
-            /* ensure any leftover reexec (shouldn't be) is freed */
-            if (reexec) free(reexec);
-            check_background_jobs();
-            continue;
-        } else { /* hres == -1 */
-            /* error already printed by intrinsics; continue */
-            continue;
-        }
+        line_status = run_line(line, NULL, 0);
     }
 
     free(line);
-    intrinsics_cleanup();
-    prompt_cleanup();
+    shell_cleanup();
     /* restore terminal mode if not already restored */
     restore_terminal_mode();
     return 0;
@@ -0,0 +1,386 @@
+#define _POSIX_C_SOURCE 200809L
+#include "parallel.h"
+#include "exec.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* One job in flight. A slot is held until the job is reaped and, with -k,
+ * its output pipe has reached EOF.
+ */
+typedef struct {
+    int active;
+    size_t seq;        /* input order */
+    pid_t pid;         /* -1 once reaped */
+    int fd;            /* output pipe read end (-k), -1 at EOF */
+    int failed;
+    char *out;         /* output not yet emitted */
+    size_t len, cap;
+} ParJob;
+
+/* Output of a finished job still waiting for its turn (-k) */
+typedef struct {
+    char *out;
+    size_t len;
+    int done;
+} ParPending;
+
+/* Where inputs come from: the words after ':::', or a stream */
+typedef struct {
+    char **words;
+    size_t nwords, next;
+    FILE *fp;
+    char *line;
+    size_t linecap;
+} ParInput;
+
+typedef struct {
+    ParJob *slots;
+    size_t nslots;
+    size_t running;    /* active slots */
+    size_t next_seq;
+    int keep_order;
+    char **tmpl;
+    size_t ntmpl;
+    int null_fd;
+    pid_t pgid;
+    size_t failed;
+    /* -k: finished outputs for seq in [next_emit, next_emit + ring_cap) */
+    ParPending *ring;
+    size_t ring_cap;   /* power of two */
+    size_t next_emit;
+} Parallel;
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(STDOUT_FILENO, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+}
+
+/* Next input, without its newline; NULL when exhausted. Empty lines are skipped. */
+static const char *next_input(ParInput *in) {
+    if (!in->fp) return in->next < in->nwords ? in->words[in->next++] : NULL;
+    ssize_t n;
+    while ((n = getline(&in->line, &in->linecap, in->fp)) >= 0) {
+        if (n > 0 && in->line[n - 1] == '\n') in->line[--n] = '\0';
+        if (n > 0) return in->line;
+    }
+    return NULL;
+}
+
+/* Substitute every '{}' in 'arg' with 'input' (arena allocated) */
+static char *subst_arg(Arena *a, const char *arg, const char *input) {
+    size_t ilen = strlen(input), len = 0;
+    for (const char *p = arg; *p; ) {
+        if (p[0] == '{' && p[1] == '}') { len += ilen; p += 2; }
+        else { len++; p++; }
+    }
+    char *s = arena_alloc(a, len + 1);
+    if (!s) return NULL;
+    char *d = s;
+    for (const char *p = arg; *p; ) {
+        if (p[0] == '{' && p[1] == '}') { memcpy(d, input, ilen); d += ilen; p += 2; }
+        else *d++ = *p++;
+    }
+    *d = '\0';
+    return s;
+}
+
+static void finish_job(Parallel *pl, ParJob *job);
+
+/* Start the template on 'input' in a free slot. */
+static void start_job(Parallel *pl, const char *input) {
+    ParJob *job = NULL;
+    for (size_t i = 0; i < pl->nslots; ++i) {
+        if (!pl->slots[i].active) { job = &pl->slots[i]; break; }
+    }
+    if (!job) return;
+    memset(job, 0, sizeof(*job));
+    job->seq = pl->next_seq++;
+    job->pid = -1;
+    job->fd = -1;
+    job->active = 1;
+    pl->running++;
+
+    Arena *arena = line_arena();
+    ArenaMark mark = arena_mark(arena);
+    CmdNode node;
+    memset(&node, 0, sizeof(node));
+    node.argv = arena_alloc(arena, sizeof(char*) * (pl->ntmpl + 2));
+    int has_slot = 0;
+    for (size_t i = 0; node.argv && i < pl->ntmpl; ++i) {
+        if (strstr(pl->tmpl[i], "{}")) {
+            has_slot = 1;
+            node.argv[node.argc] = subst_arg(arena, pl->tmpl[i], input);
+            if (!node.argv[node.argc]) { node.argv = NULL; break; }
+        } else {
+            node.argv[node.argc] = pl->tmpl[i];
+        }
+        node.argc++;
+    }
+    if (!node.argv) {
+        arena_rewind(arena, mark);
+        job->failed = 1;
+        finish_job(pl, job);
+        return;
+    }
+    if (!has_slot) node.argv[node.argc++] = (char *)input;
+    node.argv[node.argc] = NULL;
+
+    int pfd[2] = { -1, -1 };
+    if (pl->keep_order) {
+        if (pipe(pfd) != 0) {
+            perror("pipe");
+            arena_rewind(arena, mark);
+            job->failed = 1;
+            finish_job(pl, job);
+            return;
+        }
+        /* close-on-exec: only this job may hold the write end */
+        fcntl(pfd[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+        fcntl(pfd[0], F_SETFL, fcntl(pfd[0], F_GETFL) | O_NONBLOCK);
+    }
+    fflush(stdout);
+    pid_t pid;
+    if (launch_pipeline(&node, 1, pl->null_fd, pfd[1], pl->pgid, &pid) < 0) {
+        job->failed = 1;
+        if (pfd[0] >= 0) close(pfd[0]);
+        pfd[0] = -1;
+    } else {
+        job->pid = pid;
+    }
+    if (pfd[1] >= 0) close(pfd[1]);
+    job->fd = pfd[0];
+    arena_rewind(arena, mark);
+    /* a job that failed to start is finished already */
+    finish_job(pl, job);
+}
+
+static int ring_reserve(Parallel *pl, size_t seq) {
+    if (seq - pl->next_emit < pl->ring_cap) return 0;
+    size_t ncap = pl->ring_cap ? pl->ring_cap : 16;
+    while (seq - pl->next_emit >= ncap) ncap *= 2;
+    ParPending *t = calloc(ncap, sizeof(ParPending));
+    if (!t) return -1;
+    for (size_t s = pl->next_emit; s < pl->next_emit + pl->ring_cap; ++s)
+        t[s & (ncap - 1)] = pl->ring[s & (pl->ring_cap - 1)];
+    free(pl->ring);
+    pl->ring = t;
+    pl->ring_cap = ncap;
+    return 0;
+}
+
+/* Emit the outputs that are now next in input order */
+static void emit_ready(Parallel *pl) {
+    while (pl->ring_cap) {
+        ParPending *p = &pl->ring[pl->next_emit & (pl->ring_cap - 1)];
+        if (!p->done) break;
+        write_all(p->out, p->len);
+        free(p->out);
+        memset(p, 0, sizeof(*p));
+        pl->next_emit++;
+    }
+}
+
+/* Release a slot once its job is reaped and its output drained */
+static void finish_job(Parallel *pl, ParJob *job) {
+    if (job->pid > 0 || job->fd >= 0) return;
+    if (job->failed) pl->failed++;
+    if (pl->keep_order) {
+        if (job->seq == pl->next_emit) {
+            write_all(job->out, job->len);
+            free(job->out);
+            pl->next_emit++;
+            emit_ready(pl);
+        } else if (ring_reserve(pl, job->seq) == 0) {
+            ParPending *p = &pl->ring[job->seq & (pl->ring_cap - 1)];
+            p->out = job->out;
+            p->len = job->len;
+            p->done = 1;
+        } else {
+            /* out of memory: better out of order than lost */
+            write_all(job->out, job->len);
+            free(job->out);
+        }
+    }
+    job->out = NULL;
+    job->active = 0;
+    pl->running--;
+}
+
+/* Drain a job's output pipe. The job next in order streams straight
+ * through; the others buffer until their turn.
+ */
+static void read_output(Parallel *pl, ParJob *job) {
+    char buf[8192];
+    while (1) {
+        ssize_t r = read(job->fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && errno == EAGAIN) return;
+        if (r <= 0) {
+            close(job->fd);
+            job->fd = -1;
+            finish_job(pl, job);
+            return;
+        }
+        if (job->seq == pl->next_emit) {
+            write_all(job->out, job->len);
+            job->len = 0;
+            write_all(buf, (size_t)r);
+            continue;
+        }
+        if (job->len + (size_t)r > job->cap) {
+            size_t ncap = job->cap ? job->cap * 2 : sizeof(buf);
+            while (ncap < job->len + (size_t)r) ncap *= 2;
+            char *t = realloc(job->out, ncap);
+            if (!t) { write_all(buf, (size_t)r); continue; }
+            job->out = t;
+            job->cap = ncap;
+        }
+        memcpy(job->out + job->len, buf, (size_t)r);
+        job->len += (size_t)r;
+    }
+}
+
+/* Collect exited jobs. Running as a forked stage, every child is ours. */
+static void reap_jobs(Parallel *pl, int chld_fd) {
+    char buf[64];
+    if (chld_fd >= 0) while (read(chld_fd, buf, sizeof(buf)) > 0) { }
+    while (1) {
+        int status;
+        pid_t w = waitpid(-1, &status, WNOHANG);
+        if (w <= 0) break;
+        for (size_t i = 0; i < pl->nslots; ++i) {
+            ParJob *job = &pl->slots[i];
+            if (!job->active || job->pid != w) continue;
+            job->pid = -1;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) job->failed = 1;
+            finish_job(pl, job);
+            break;
+        }
+    }
+}
+
+static void run_jobs(Parallel *pl, ParInput *in) {
+    int chld_fd = exec_sigchld_fd();
+    struct pollfd *pfds = malloc(sizeof(struct pollfd) * (pl->nslots + 1));
+    ParJob **owners = malloc(sizeof(ParJob*) * (pl->nslots + 1));
+    if (!pfds || !owners) {
+        free(pfds);
+        free(owners);
+        return;
+    }
+    int eof = 0;
+    while (1) {
+        while (!eof && pl->running < pl->nslots) {
+            const char *input = next_input(in);
+            if (!input) { eof = 1; break; }
+            start_job(pl, input);
+        }
+        if (pl->running == 0) break;
+
+        nfds_t n = 0;
+        pfds[n].fd = chld_fd;
+        pfds[n].events = POLLIN;
+        pfds[n].revents = 0;
+        owners[n++] = NULL;
+        for (size_t i = 0; i < pl->nslots; ++i) {
+            if (!pl->slots[i].active || pl->slots[i].fd < 0) continue;
+            pfds[n].fd = pl->slots[i].fd;
+            pfds[n].events = POLLIN;
+            pfds[n].revents = 0;
+            owners[n++] = &pl->slots[i];
+        }
+        /* without a self-pipe there is nothing to wake us: fall back to ticks */
+        if (poll(pfds, n, chld_fd >= 0 ? -1 : 10) < 0 && errno != EINTR) break;
+        for (nfds_t i = 1; i < n; ++i) {
+            if (pfds[i].revents && owners[i]->fd >= 0) read_output(pl, owners[i]);
+        }
+        reap_jobs(pl, chld_fd);
+    }
+    free(pfds);
+    free(owners);
+}
+
+static long online_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+int builtin_parallel(char **argv, size_t argc) {
+    Parallel pl;
+    memset(&pl, 0, sizeof(pl));
+    long njobs = online_cpus();
+    const char *arg_file = NULL;
+
+    size_t i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "-k") == 0) {
+            pl.keep_order = 1;
+        } else if (strncmp(opt, "-j", 2) == 0 || strcmp(opt, "-a") == 0) {
+            const char *val = opt[2] ? opt + 2 : (i + 1 < argc ? argv[++i] : NULL);
+            if (!val) { printf("parallel: Invalid Syntax!\n"); return 255; }
+            if (opt[1] == 'a') {
+                arg_file = val;
+                continue;
+            }
+            char *end;
+            njobs = strtol(val, &end, 10);
+            if (*end != '\0' || njobs <= 0) { printf("parallel: Invalid Syntax!\n"); return 255; }
+        } else {
+            printf("parallel: Invalid Syntax!\n");
+            return 255;
+        }
+    }
+    pl.tmpl = argv + i;
+    while (i < argc && strcmp(argv[i], ":::") != 0) i++;
+    pl.ntmpl = (size_t)(argv + i - pl.tmpl);
+    if (pl.ntmpl == 0) { printf("parallel: Invalid Syntax!\n"); return 255; }
+
+    ParInput in;
+    memset(&in, 0, sizeof(in));
+    if (i < argc) {
+        if (arg_file) { printf("parallel: Invalid Syntax!\n"); return 255; }
+        in.words = argv + i + 1;
+        in.nwords = argc - i - 1;
+    } else if (arg_file) {
+        in.fp = fopen(arg_file, "r");
+        if (!in.fp) { printf("parallel: %s: No such file or directory\n", arg_file); return 255; }
+    } else if (isatty(STDIN_FILENO)) {
+        printf("parallel: no input (use -a <file>, ::: or a pipe)\n");
+        return 255;
+    } else {
+        in.fp = stdin;
+    }
+
+    pl.nslots = (size_t)njobs;
+    pl.slots = calloc(pl.nslots, sizeof(ParJob));
+    pl.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    /* jobs join our group so terminal signals and fg/bg reach them too */
+    pl.pgid = getpgrp();
+    if (pl.slots) run_jobs(&pl, &in);
+
+    if (in.fp && in.fp != stdin) fclose(in.fp);
+    free(in.line);
+    if (pl.null_fd >= 0) close(pl.null_fd);
+    free(pl.slots);
+    free(pl.ring);
+    fflush(stdout);
+    return pl.failed > 100 ? 100 : (int)pl.failed;
+}
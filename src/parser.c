@@ -1,10 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 #include "parser.h"
+#include "arena.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
 /* Tokenizer for our grammar */
 typedef enum {
@@ -22,13 +22,14 @@ typedef enum {
 
 typedef struct {
     TokenType type;
-    char *text; /* for TOK_NAME */
+    char *text; /* for TOK_NAME, arena-allocated */
 } Token;
 
 typedef struct {
     const char *s;
     size_t pos;
     Token cur;
+    Arena *arena;
 } Lexer;
 
 /* helpers */
@@ -39,23 +40,17 @@ static int is_name_char(char c) {
     return 1;
 }
 
-static void token_free(Token *t) {
-    if (!t) return;
-    free(t->text);
-    t->text = NULL;
-    t->type = TOK_NONE;
-}
-
-static void lexer_init(Lexer *lx, const char *s) {
+static void lexer_init(Lexer *lx, Arena *arena, const char *s) {
     lx->s = s ? s : "";
     lx->pos = 0;
     lx->cur.type = TOK_NONE;
     lx->cur.text = NULL;
+    lx->arena = arena;
 }
 
-/* produce next token into lx->cur (caller must free previous via token_free) */
+/* produce next token into lx->cur (name text lives in the arena) */
 static void lexer_next(Lexer *lx) {
-    token_free(&lx->cur);
+    lx->cur.text = NULL;
     const char *str = lx->s;
     size_t i = lx->pos;
 
@@ -99,15 +94,12 @@ static void lexer_next(Lexer *lx) {
     } else {
         size_t start = i;
         while (str[i] && is_name_char(str[i])) i++;
-        size_t len = i - start;
-        char *buf = malloc(len + 1);
+        char *buf = arena_strndup(lx->arena, &str[start], i - start);
         if (!buf) {
             lx->cur.type = TOK_ERROR;
             lx->pos = i;
             return;
         }
-        memcpy(buf, &str[start], len);
-        buf[len] = '\0';
         lx->cur.type = TOK_NAME;
         lx->cur.text = buf;
         lx->pos = i;
@@ -116,194 +108,187 @@ static void lexer_next(Lexer *lx) {
 }
 
 
-static int parse_atomic(Lexer *lx); 
+/* Growable text buffer used to build CmdGroup.text */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} TextBuf;
 
-static int parse_cmd_group(Lexer *lx) {
-    if (!parse_atomic(lx)) return 0;
-    while (lx->cur.type == TOK_PIPE) {
-        lexer_next(lx);
-        if (!parse_atomic(lx)) return 0;
+/* Parser state: lexer plus the text of the group being built */
+typedef struct {
+    Lexer lx;
+    Arena *arena;
+    TextBuf text;
+    int oom;
+} Parser;
+
+static void text_append(Parser *ps, const char *s) {
+    TextBuf *tb = &ps->text;
+    size_t n = strlen(s);
+    size_t need = tb->len + (tb->len ? 1 : 0) + n + 1;
+    if (need > tb->cap) {
+        size_t ncap = tb->cap ? tb->cap : 32;
+        while (ncap < need) ncap *= 2;
+        char *t = arena_realloc(ps->arena, tb->buf, tb->cap, ncap);
+        if (!t) { ps->oom = 1; return; }
+        tb->buf = t;
+        tb->cap = ncap;
     }
-    if (lx->cur.type == TOK_AMP) {
-        lexer_next(lx);
+    if (tb->len) tb->buf[tb->len++] = ' ';
+    memcpy(tb->buf + tb->len, s, n + 1);
+    tb->len += n;
+}
+
+static const char *token_display(const Token *t) {
+    switch (t->type) {
+    case TOK_NAME: return t->text;
+    case TOK_PIPE: return "|";
+    case TOK_LT:   return "<";
+    case TOK_GT:   return ">";
+    case TOK_GTGT: return ">>";
+    default:       return "";
     }
-    return 1;
 }
 
-static int parse_atomic(Lexer *lx) {
+/* Record the current token in the group text and advance */
+static void parser_advance(Parser *ps) {
+    text_append(ps, token_display(&ps->lx.cur));
+    lexer_next(&ps->lx);
+}
+
+/* Take the current name token's text and advance */
+static char *parser_take_name(Parser *ps) {
+    char *name = ps->lx.cur.text;
+    text_append(ps, name);
+    lexer_next(&ps->lx);
+    return name;
+}
+
+/* <atomic> ::= <name> [ <name> | '<' <name> | '>' <name> | '>>' <name> ]* */
+static int parse_atomic(Parser *ps, CmdNode *node) {
+    Lexer *lx = &ps->lx;
+    memset(node, 0, sizeof(*node));
     if (lx->cur.type != TOK_NAME) return 0;
-    lexer_next(lx);
+
+    size_t cap = 4;
+    node->argv = arena_alloc(ps->arena, sizeof(char*) * cap);
+    if (!node->argv) { ps->oom = 1; return 0; }
+    node->argv[node->argc++] = parser_take_name(ps);
+    node->argv[node->argc] = NULL;
 
     while (1) {
         if (lx->cur.type == TOK_NAME) {
-            lexer_next(lx);
+            if (node->argc + 2 > cap) {
+                char **t = arena_realloc(ps->arena, node->argv, sizeof(char*) * cap,
+                                         sizeof(char*) * cap * 2);
+                if (!t) { ps->oom = 1; return 0; }
+                node->argv = t;
+                cap *= 2;
+            }
+            node->argv[node->argc++] = parser_take_name(ps);
+            node->argv[node->argc] = NULL;
             continue;
         } else if (lx->cur.type == TOK_LT) {
-            lexer_next(lx); 
+            parser_advance(ps);
             if (lx->cur.type != TOK_NAME) return 0;
-            lexer_next(lx);
+            node->infile = parser_take_name(ps);
             continue;
         } else if (lx->cur.type == TOK_GT || lx->cur.type == TOK_GTGT) {
-            lexer_next(lx);
+            int append = (lx->cur.type == TOK_GTGT);
+            parser_advance(ps);
             if (lx->cur.type != TOK_NAME) return 0;
-            lexer_next(lx);
+            node->outfile = parser_take_name(ps);
+            node->append = append;
             continue;
         } else {
             break;
         }
     }
-    return 1;
+    /* lexer position is just past the token that ended this atomic; back up
+     * over it so src_end points at the separator (or end of line) */
+    size_t end = lx->pos;
+    if (lx->cur.type != TOK_EOF) end--;
+    node->src_end = end;
+    return !ps->oom;
 }
 
-bool validate_syntax(const char *line) {
-    if (!line) return false;
-    Lexer lx;
-    lexer_init(&lx, line);
-    lexer_next(&lx); 
+/* <command_group> ::= <atomic> [ '|' <atomic> ]* [ '&' ] */
+static int parse_cmd_group(Parser *ps, CmdGroup *g) {
+    Lexer *lx = &ps->lx;
+    size_t cap = 2;
+    memset(g, 0, sizeof(*g));
+    ps->text.buf = NULL;
+    ps->text.len = ps->text.cap = 0;
 
-    if (!parse_cmd_group(&lx)) {
-        token_free(&lx.cur);
-        return false;
-    }
+    g->cmds = arena_alloc(ps->arena, sizeof(CmdNode) * cap);
+    if (!g->cmds) { ps->oom = 1; return 0; }
 
-    while (lx.cur.type == TOK_SEMI) {
-        lexer_next(&lx);
-        if (!parse_cmd_group(&lx)) {
-            token_free(&lx.cur);
-            return false;
+    while (1) {
+        if (g->ncmds == cap) {
+            CmdNode *t = arena_realloc(ps->arena, g->cmds, sizeof(CmdNode) * cap,
+                                       sizeof(CmdNode) * cap * 2);
+            if (!t) { ps->oom = 1; return 0; }
+            g->cmds = t;
+            cap *= 2;
         }
+        if (!parse_atomic(ps, &g->cmds[g->ncmds])) return 0;
+        g->ncmds++;
+        if (lx->cur.type != TOK_PIPE) break;
+        parser_advance(ps);
     }
-
-    bool ok = (lx.cur.type == TOK_EOF);
-    token_free(&lx.cur);
-    return ok;
-}
-
-static int is_special_tok(const char *tok) {
-    return (strcmp(tok, "|") == 0 || strcmp(tok, ">>") == 0 ||
-            strcmp(tok, ";") == 0 || strcmp(tok, "&") == 0);
-}
-
-/* check a single character to see if it's a special token start */
-static int is_special_char(char c) {
-    return (c == '|' || c == ';' || c == '&' || c == '<' || c == '>');
-}
-
-/* Free token array returned by tokenize_special */
-static void free_tokens(char **toks) {
-    if (!toks) return;
-    for (size_t i = 0; toks[i]; ++i) free(toks[i]);
-    free(toks);
+    if (lx->cur.type == TOK_AMP) {
+        g->background = 1;
+        lexer_next(lx);
+    }
+    g->text = ps->text.buf ? ps->text.buf : arena_strdup(ps->arena, "");
+    if (!g->text) ps->oom = 1;
+    return !ps->oom;
 }
 
-/* Tokenize input into tokens where special symbols are separate tokens */
-static char **tokenize_special(const char *line, size_t *out_count) {
-    if (!line) { if (out_count) *out_count = 0; return NULL; }
-    size_t cap = 16, n = 0;
-    char **arr = malloc(sizeof(char*) * cap);
-    if (!arr) return NULL;
-
-    const char *p = line;
-    while (*p) {
-        while (*p && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
-        if (!*p) break;
+/* <line> ::= <command_group> [ ';' <command_group> ]* */
+CmdLine *parse_command_line(Arena *arena, const char *line) {
+    if (!line) return NULL;
+    ArenaMark mark = arena_mark(arena);
+    CmdLine *cl = arena_calloc(arena, sizeof(CmdLine));
+    if (!cl) goto fail;
+    cl->src = arena_strdup(arena, line);
+    size_t cap = 2;
+    cl->groups = arena_alloc(arena, sizeof(CmdGroup) * cap);
+    if (!cl->src || !cl->groups) goto fail;
+
+    Parser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.arena = arena;
+    lexer_init(&ps.lx, arena, cl->src);
+    lexer_next(&ps.lx);
 
-        /* check special tokens */
-        if (*p == '|' || *p == ';' || *p == '&' || *p == '<') {
-            char t[2] = {*p, '\0'};
-            arr[n] = strdup(t);
-            if (!arr[n]) goto fail;
-            ++n;
-            ++p;
-        } else if (*p == '>') {
-            if (p[1] == '>') {
-                arr[n] = strdup(">>");
-                if (!arr[n]) goto fail;
-                ++n;
-                p += 2;
-            } else {
-                arr[n] = strdup(">");
-                if (!arr[n]) goto fail;
-                ++n;
-                ++p;
-            }
-        } else {
-            /* name token: stop at whitespace or any special character */
-            const char *start = p;
-            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && !is_special_char(*p)) ++p;
-            size_t len = p - start;
-            arr[n] = malloc(len + 1);
-            if (!arr[n]) goto fail;
-            memcpy(arr[n], start, len);
-            arr[n][len] = '\0';
-            ++n;
-        }
-
-        if (n + 1 >= cap) {
+    while (1) {
+        if (cl->ngroups == cap) {
+            CmdGroup *t = arena_realloc(arena, cl->groups, sizeof(CmdGroup) * cap,
+                                        sizeof(CmdGroup) * cap * 2);
+            if (!t) goto fail;
+            cl->groups = t;
             cap *= 2;
-            char **new_arr = realloc(arr, sizeof(char*) * cap);
-            if (!new_arr) goto fail;
-            arr = new_arr;
         }
+        if (!parse_cmd_group(&ps, &cl->groups[cl->ngroups])) goto fail;
+        cl->ngroups++;
+        if (ps.lx.cur.type != TOK_SEMI) break;
+        lexer_next(&ps.lx);
     }
-
-    arr[n] = NULL;
-    if (out_count) *out_count = n;
-    return arr;
+    if (ps.lx.cur.type != TOK_EOF) goto fail;
+    return cl;
 
 fail:
-    for (size_t i = 0; i < n; ++i) free(arr[i]);
-    free(arr);
-    if (out_count) *out_count = 0;
+    /* invalid lines give their memory straight back */
+    arena_rewind(arena, mark);
     return NULL;
 }
 
-int parse_line(const char *line) {
-    if (!line || !*line) return 1;
-    size_t ntoks = 0;
-    char **toks = tokenize_special(line, &ntoks);
-    if (!toks) return 1;
-
-    /* Basic validation */
-    if (ntoks == 0) {
-        free_tokens(toks);
-        return 1;
-    }
-
-    /* Check for invalid special token at start */
-    if (is_special_tok(toks[0])) {
-        free_tokens(toks);
-        return 1;
-    }
-
-    /* Check special tokens */
-    for (size_t i = 0; i < ntoks; ++i) {
-        if (strcmp(toks[i], "|") == 0 || strcmp(toks[i], ";") == 0) {
-            /* Pipe and semicolon can't be at end and must have command after */
-            if (i == ntoks - 1 || is_special_tok(toks[i + 1])) {
-                free_tokens(toks);
-                return 1;
-            }
-        } else if (strcmp(toks[i], "&") == 0) {
-            /* & can appear at the end of command */
-            if (i == 0 || (i < ntoks - 1 && strcmp(toks[i + 1], ";") != 0)) {
-                free_tokens(toks);
-                return 1;
-            }
-        }
-    }
-
-    /* Check IO redirections */
-    for (size_t i = 0; i < ntoks; ++i) {
-        if ((strcmp(toks[i], "<") == 0 || strcmp(toks[i], ">") == 0 || 
-             strcmp(toks[i], ">>") == 0)) {
-            if (i == ntoks - 1 || is_special_tok(toks[i + 1])) {
-                free_tokens(toks);
-                return 1;
-            }
-        }
-    }
-
-    free_tokens(toks);
-    return 0;
+bool validate_syntax(const char *line) {
+    Arena *arena = line_arena();
+    ArenaMark mark = arena_mark(arena);
+    CmdLine *cl = parse_command_line(arena, line);
+    arena_rewind(arena, mark);
+    return cl != NULL;
 }
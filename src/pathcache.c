@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pathcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* execvp's search path when $PATH is unset */
+static const char *DEFAULT_PATH = "/bin:/usr/bin";
+
+typedef struct {
+    char *name;          /* NULL => empty slot */
+    char *path;
+    unsigned long hits;
+} PathEntry;
+
+/* One $PATH component and the mtime it had when the table was filled */
+typedef struct {
+    char *dir;
+    int exists;
+    struct timespec mtime;
+} PathDir;
+
+static PathEntry *table = NULL;   /* open addressing, linear probing */
+static size_t table_cap = 0;      /* power of two */
+static size_t table_count = 0;
+
+static char *cached_path_env = NULL;
+static PathDir *path_dirs = NULL;
+static size_t path_ndirs = 0;
+
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+/* FNV-1a */
+static size_t hash_name(const char *s) {
+    size_t h = 2166136261u;
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void table_free_entries(void) {
+    for (size_t i = 0; i < table_cap; ++i) {
+        free(table[i].name);
+        free(table[i].path);
+        table[i].name = NULL;
+        table[i].path = NULL;
+        table[i].hits = 0;
+    }
+    table_count = 0;
+}
+
+void pathcache_clear(void) {
+    table_free_entries();
+}
+
+static int table_grow(void) {
+    size_t ncap = table_cap ? table_cap * 2 : 64;
+    PathEntry *nt = calloc(ncap, sizeof(PathEntry));
+    if (!nt) return -1;
+    for (size_t i = 0; i < table_cap; ++i) {
+        if (!table[i].name) continue;
+        size_t j = hash_name(table[i].name) & (ncap - 1);
+        while (nt[j].name) j = (j + 1) & (ncap - 1);
+        nt[j] = table[i];
+    }
+    free(table);
+    table = nt;
+    table_cap = ncap;
+    return 0;
+}
+
+static PathEntry *table_find(const char *name) {
+    if (table_count == 0) return NULL;
+    size_t j = hash_name(name) & (table_cap - 1);
+    while (table[j].name) {
+        if (strcmp(table[j].name, name) == 0) return &table[j];
+        j = (j + 1) & (table_cap - 1);
+    }
+    return NULL;
+}
+
+static PathEntry *table_insert(const char *name, const char *path) {
+    /* keep the load factor under 1/2 */
+    if ((table_count + 1) * 2 > table_cap && table_grow() != 0) return NULL;
+    char *n = strdup(name);
+    char *p = strdup(path);
+    if (!n || !p) { free(n); free(p); return NULL; }
+    size_t j = hash_name(name) & (table_cap - 1);
+    while (table[j].name) j = (j + 1) & (table_cap - 1);
+    table[j].name = n;
+    table[j].path = p;
+    table[j].hits = 0;
+    table_count++;
+    return &table[j];
+}
+
+static void free_path_dirs(void) {
+    for (size_t i = 0; i < path_ndirs; ++i) free(path_dirs[i].dir);
+    free(path_dirs);
+    path_dirs = NULL;
+    path_ndirs = 0;
+}
+
+static void stat_dir(PathDir *d) {
+    struct stat st;
+    if (stat(d->dir, &st) == 0) {
+        d->exists = 1;
+        d->mtime = st.st_mtim;
+    } else {
+        d->exists = 0;
+        d->mtime.tv_sec = 0;
+        d->mtime.tv_nsec = 0;
+    }
+}
+
+/* Split $PATH into path_dirs (an empty component means ".") */
+static int load_path_dirs(const char *env) {
+    free_path_dirs();
+    free(cached_path_env);
+    cached_path_env = strdup(env);
+    if (!cached_path_env) return -1;
+
+    size_t n = 1;
+    for (const char *p = env; *p; ++p) if (*p == ':') n++;
+    path_dirs = calloc(n, sizeof(PathDir));
+    if (!path_dirs) return -1;
+
+    const char *start = env;
+    while (1) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        PathDir *d = &path_dirs[path_ndirs];
+        d->dir = len ? strndup(start, len) : strdup(".");
+        if (!d->dir) return -1;
+        stat_dir(d);
+        path_ndirs++;
+        if (!end) break;
+        start = end + 1;
+    }
+    return 0;
+}
+
+void pathcache_validate(void) {
+    const char *env = getenv("PATH");
+    if (!env) env = DEFAULT_PATH;
+    if (!cached_path_env || strcmp(cached_path_env, env) != 0) {
+        table_free_entries();
+        if (load_path_dirs(env) != 0) free_path_dirs();
+        return;
+    }
+    int changed = 0;
+    for (size_t i = 0; i < path_ndirs; ++i) {
+        PathDir *d = &path_dirs[i];
+        int was = d->exists;
+        struct timespec old = d->mtime;
+        stat_dir(d);
+        if (d->exists != was || d->mtime.tv_sec != old.tv_sec ||
+            d->mtime.tv_nsec != old.tv_nsec) {
+            changed = 1;
+        }
+    }
+    /* something was added, removed or renamed in a PATH directory */
+    if (changed) table_free_entries();
+}
+
+static int is_executable_file(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    if (!S_ISREG(st.st_mode)) return 0;
+    return access(path, X_OK) == 0;
+}
+
+/* Walk $PATH for 'name'. Absolute hits are inserted into the table and
+ * *out_entry is set; results from relative components are returned without
+ * caching since they depend on the cwd.
+ */
+static const char *search_path(const char *name, PathEntry **out_entry) {
+    static char candidate[PATH_MAX];
+    *out_entry = NULL;
+    for (size_t i = 0; i < path_ndirs; ++i) {
+        if (!path_dirs[i].exists) continue;
+        int n = snprintf(candidate, sizeof(candidate), "%s/%s", path_dirs[i].dir, name);
+        if (n < 0 || (size_t)n >= sizeof(candidate)) continue;
+        if (!is_executable_file(candidate)) continue;
+        if (path_dirs[i].dir[0] != '/') return candidate;
+        PathEntry *e = table_insert(name, candidate);
+        if (!e) return candidate;
+        *out_entry = e;
+        return e->path;
+    }
+    return NULL;
+}
+
+const char *pathcache_lookup(const char *name) {
+    if (!name || !*name) return NULL;
+    if (!cached_path_env) pathcache_validate();
+
+    PathEntry *e = table_find(name);
+    if (e) {
+        e->hits++;
+        cache_hits++;
+        return e->path;
+    }
+    cache_misses++;
+    const char *path = search_path(name, &e);
+    if (e) e->hits++;
+    return path;
+}
+
+int pathcache_add(const char *name) {
+    if (!name || !*name || strchr(name, '/')) return -1;
+    pathcache_validate();
+    if (table_find(name)) return 0;
+    PathEntry *e = NULL;
+    return search_path(name, &e) ? 0 : -1;
+}
+
+void pathcache_print(void) {
+    if (table_count == 0) {
+        printf("hash: hash table empty\n");
+    } else {
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < table_cap; ++i) {
+            if (!table[i].name) continue;
+            printf("%4lu\t%s\n", table[i].hits, table[i].path);
+        }
+    }
+    printf("lookups: %lu hits, %lu misses\n", cache_hits, cache_misses);
+}
+
+void pathcache_cleanup(void) {
+    table_free_entries();
+    free(table);
+    table = NULL;
+    table_cap = 0;
+    free_path_dirs();
+    free(cached_path_env);
+    cached_path_env = NULL;
+}
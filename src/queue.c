@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+#include "queue.h"
+#include "exec.h"
+#include "parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+typedef enum { Q_PENDING, Q_RUNNING, Q_DONE } QueueState;
+
+typedef struct QueueEntry {
+    int id;
+    QueueState state;
+    char *command;
+    struct timespec queued, started, ended;
+    pid_t pgid;      /* while running */
+    int status;      /* wait status once done */
+    struct QueueEntry *next;
+} QueueEntry;
+
+/* Entries in submission order; they start strictly FIFO, so every entry
+ * from next_pending on is still pending.
+ */
+static QueueEntry *q_head = NULL, *q_tail = NULL;
+static QueueEntry *next_pending = NULL;
+static int next_id = 1;
+static size_t npending = 0, nrunning = 0;
+static size_t slot_limit = 0;      /* 0 => online CPUs */
+static double max_load = 0.0;      /* 0 => no load limit */
+/* process that owns the queue: forked pipeline stages see a copy of the
+ * entries but must never start them */
+static pid_t queue_pid = 0;
+
+/* Re-check interval while entries wait for the load to drop */
+#define LOAD_RECHECK_MS 1000
+
+static size_t slots(void) {
+    if (slot_limit) return slot_limit;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+}
+
+/* 1-minute load average, or -1 if /proc/loadavg cannot be read */
+static double load_average(void) {
+    char buf[64];
+    int fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1.0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1.0;
+    buf[n] = '\0';
+    return strtod(buf, NULL);
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+void queue_schedule(void) {
+    if (!next_pending || getpid() != queue_pid) return;
+    size_t limit = slots();
+    if (nrunning >= limit) return;
+    /* the load average lags, so each admitted entry counts as one more */
+    double load = max_load > 0 ? load_average() : -1.0;
+    while (next_pending && nrunning < limit) {
+        if (load >= 0 && load >= max_load) return;
+        QueueEntry *e = next_pending;
+        next_pending = e->next;
+        npending--;
+        clock_gettime(CLOCK_MONOTONIC, &e->started);
+        bg_job *job = exec_start_job(e->command);
+        if (!job) {
+            e->state = Q_DONE;
+            e->status = 1 << 8;
+            e->ended = e->started;
+            continue;
+        }
+        job->owner = e;
+        job->on_done = queue_job_done;
+        e->pgid = job->pid;
+        e->state = Q_RUNNING;
+        nrunning++;
+        if (load >= 0) load += 1.0;
+    }
+}
+
+void queue_job_done(void *entry, int status) {
+    QueueEntry *e = entry;
+    if (e->state != Q_RUNNING) return;
+    e->state = Q_DONE;
+    e->status = status;
+    clock_gettime(CLOCK_MONOTONIC, &e->ended);
+    nrunning--;
+}
+
+int queue_poll_timeout(void) {
+    if (!next_pending || max_load <= 0 || getpid() != queue_pid) return -1;
+    return nrunning < slots() ? LOAD_RECHECK_MS : -1;
+}
+
+static int queue_add(char **words, size_t n) {
+    size_t len = 1;
+    for (size_t i = 0; i < n; ++i) len += strlen(words[i]) + 1;
+    char *cmd = malloc(len);
+    if (!cmd) return 1;
+    char *p = cmd;
+    for (size_t i = 0; i < n; ++i) {
+        size_t wl = strlen(words[i]);
+        if (i) *p++ = ' ';
+        memcpy(p, words[i], wl);
+        p += wl;
+    }
+    *p = '\0';
+    if (!validate_syntax(cmd)) {
+        printf("Invalid Syntax!\n");
+        free(cmd);
+        return 1;
+    }
+    QueueEntry *e = calloc(1, sizeof(QueueEntry));
+    if (!e) { free(cmd); return 1; }
+    e->id = next_id++;
+    e->state = Q_PENDING;
+    e->command = cmd;
+    clock_gettime(CLOCK_MONOTONIC, &e->queued);
+    if (q_tail) q_tail->next = e; else q_head = e;
+    q_tail = e;
+    if (!next_pending) next_pending = e;
+    npending++;
+    printf("Queued entry %d\n", e->id);
+    fflush(stdout);
+    queue_schedule();
+    return 0;
+}
+
+static void queue_status(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (const QueueEntry *e = q_head; e; e = e->next) {
+        if (e->state == Q_PENDING) {
+            printf("%4d  pending  %8.2fs  %s\n", e->id, elapsed(&e->queued, &now), e->command);
+        } else if (e->state == Q_RUNNING) {
+            printf("%4d  running  %8.2fs  %s (pid %d)\n", e->id,
+                   elapsed(&e->started, &now), e->command, e->pgid);
+        } else if (WIFEXITED(e->status)) {
+            printf("%4d  done     %8.2fs  %s (exit %d)\n", e->id,
+                   elapsed(&e->started, &e->ended), e->command, WEXITSTATUS(e->status));
+        } else {
+            printf("%4d  done     %8.2fs  %s (signal %d)\n", e->id,
+                   elapsed(&e->started, &e->ended), e->command,
+                   WIFSIGNALED(e->status) ? WTERMSIG(e->status) : 0);
+        }
+    }
+    printf("running %zu/%zu, pending %zu, load limit ", nrunning, slots(), npending);
+    if (max_load > 0) printf("%.2f (now %.2f)\n", max_load, load_average());
+    else printf("off\n");
+}
+
+/* Forget finished entries */
+static void queue_clear_done(void) {
+    QueueEntry **pp = &q_head;
+    q_tail = NULL;
+    while (*pp) {
+        QueueEntry *e = *pp;
+        if (e->state == Q_DONE) {
+            *pp = e->next;
+            free(e->command);
+            free(e);
+        } else {
+            q_tail = e;
+            pp = &e->next;
+        }
+    }
+}
+
+void queue_init(void) {
+    queue_pid = getpid();
+}
+
+int builtin_queue(char **argv, size_t argc) {
+    const char *sub = argc > 1 ? argv[1] : "status";
+    /* a forked stage (queue add x > f, queue in a pipeline) only has a
+     * copy of the queue: changes there would never reach the shell */
+    int readonly = strcmp(sub, "status") == 0 || (strcmp(sub, "limit") == 0 && argc == 2) ||
+                   (strcmp(sub, "load") == 0 && argc == 2);
+    if (!readonly && getpid() != queue_pid) {
+        printf("queue: must run in the shell itself, not in a pipeline or redirection\n");
+        return 1;
+    }
+    if (strcmp(sub, "status") == 0 && argc <= 2) {
+        queue_status();
+    } else if (strcmp(sub, "add") == 0 && argc > 2) {
+        return queue_add(argv + 2, argc - 2);
+    } else if (strcmp(sub, "limit") == 0 && argc <= 3) {
+        if (argc == 2) { printf("%zu\n", slots()); return 0; }
+        char *end;
+        long v = strtol(argv[2], &end, 10);
+        if (*end != '\0' || v < 0) { printf("queue: Invalid Syntax!\n"); return 1; }
+        slot_limit = (size_t)v;
+        queue_schedule();
+    } else if (strcmp(sub, "load") == 0 && argc <= 3) {
+        if (argc == 2) {
+            if (max_load > 0) printf("%.2f\n", max_load);
+            else printf("off\n");
+            return 0;
+        }
+        char *end;
+        double v = strtod(argv[2], &end);
+        if (*end != '\0' || v < 0) { printf("queue: Invalid Syntax!\n"); return 1; }
+        max_load = v;
+        queue_schedule();
+    } else if (strcmp(sub, "clear") == 0 && argc == 2) {
+        queue_clear_done();
+    } else {
+        printf("queue: Invalid Syntax!\n");
+        return 1;
+    }
+    return 0;
+}
+
+void queue_cleanup(void) {
+    while (q_head) {
+        QueueEntry *e = q_head;
+        q_head = e->next;
+        free(e->command);
+        free(e);
+    }
+    q_tail = next_pending = NULL;
+    npending = nrunning = 0;
+}
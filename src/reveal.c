@@ -0,0 +1,952 @@
+#define _GNU_SOURCE
+#include "reveal.h"
+#include "dircache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* Bytes asked of the kernel per getdents64 call */
+#define DENTS_BUF (256 * 1024)
+/* Below this many entries insertion sort beats another radix pass */
+#define RADIX_MIN 64
+/* Output is collected up to this size per write() */
+#define OUT_BUF (64 * 1024)
+/* Long listings of at least this many entries stat in parallel */
+#define STAT_PARALLEL_MIN 256
+/* Stat threads, main thread included; stat mostly waits on the filesystem */
+#define STAT_THREADS 8
+/* Entries a stat thread claims at a time */
+#define STAT_CHUNK 64
+/* Most -R walker threads, and directory fds they may hold open in queues */
+#define WALK_THREADS_MAX 64
+#define WALK_FDS 256
+
+/* Record layout returned by getdents64 */
+struct dent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static uint64_t name_key(const char *name, size_t len) {
+    const unsigned char *p = (const unsigned char *)name;
+    if (len >= 8) {
+        return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 | (uint64_t)p[2] << 40 |
+               (uint64_t)p[3] << 32 | (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+               (uint64_t)p[6] << 8 | (uint64_t)p[7];
+    }
+    uint64_t k = 0;
+    for (size_t i = 0; i < 8; ++i) k = k << 8 | (i < len ? p[i] : 0);
+    return k;
+}
+
+static int dirlist_add(DirListing *dl, const char *name, unsigned char type) {
+    size_t len = strlen(name);
+    if (len == 1 && name[0] == '.') return 0;
+    if (len == 2 && name[0] == '.' && name[1] == '.') return 0;
+    if (dl->names_len + len + 1 > dl->names_cap) {
+        size_t ncap = dl->names_cap ? dl->names_cap * 2 : 4096;
+        while (dl->names_len + len + 1 > ncap) ncap *= 2;
+        char *t = realloc(dl->names, ncap);
+        if (!t) return -1;
+        dl->names = t;
+        dl->names_cap = ncap;
+    }
+    if (dl->n == dl->cap) {
+        size_t ncap = dl->cap ? dl->cap * 2 : 64;
+        RevealEnt *t = realloc(dl->ents, ncap * sizeof(RevealEnt));
+        if (!t) return -1;
+        dl->ents = t;
+        dl->cap = ncap;
+    }
+    RevealEnt *e = &dl->ents[dl->n++];
+    e->key = name_key(name, len);
+    e->off = (uint32_t)dl->names_len;
+    e->len = (uint16_t)len;
+    e->type = type;
+    memcpy(dl->names + dl->names_len, name, len + 1);
+    dl->names_len += len + 1;
+    return 0;
+}
+
+/* Insertion sort for short runs whose names share their first 'depth' bytes */
+static void insertion_sort(const char *names, RevealEnt *e, size_t n, size_t depth) {
+    for (size_t i = 1; i < n; ++i) {
+        RevealEnt v = e[i];
+        const char *vn = names + v.off + depth;
+        size_t j = i;
+        while (j > 0 && strcmp(names + e[j - 1].off + depth, vn) > 0) {
+            e[j] = e[j - 1];
+            j--;
+        }
+        e[j] = v;
+    }
+}
+
+/* Scratch space for one sort */
+typedef struct {
+    const char *names;
+    RevealEnt *tmp;
+    size_t (*count)[256];
+} SortCtx;
+
+/* Sort e[0..n), whose names all share their first 'depth' bytes while the
+ * keys hold the next 8. An LSD radix pass is made for each key byte that
+ * varies; runs still tied on the whole key then recurse 8 bytes deeper.
+ */
+static void radix_sort(SortCtx *ctx, RevealEnt *e, size_t n, size_t depth) {
+    if (n < RADIX_MIN) {
+        insertion_sort(ctx->names, e, n, depth);
+        return;
+    }
+    size_t (*count)[256] = ctx->count;
+    memset(count, 0, 8 * sizeof(*count));
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t k = e[i].key;
+        for (int b = 0; b < 8; ++b) count[b][(k >> (8 * b)) & 0xff]++;
+    }
+    RevealEnt *src = e, *dst = ctx->tmp;
+    for (int b = 0; b < 8; ++b) {
+        size_t *c = count[b];
+        /* every key has the same byte here: the pass would not move anything */
+        if (c[(src[0].key >> (8 * b)) & 0xff] == n) continue;
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t v = c[d];
+            c[d] = sum;
+            sum += v;
+        }
+        for (size_t i = 0; i < n; ++i) dst[c[(src[i].key >> (8 * b)) & 0xff]++] = src[i];
+        RevealEnt *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != e) memcpy(e, src, n * sizeof(RevealEnt));
+
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && e[j].key == e[i].key) j++;
+        /* a key ending in a zero byte holds a whole name: no ties there */
+        if (j - i > 1 && (e[i].key & 0xff) != 0) {
+            for (size_t k = i; k < j; ++k) {
+                e[k].key = name_key(ctx->names + e[k].off + depth + 8,
+                                    e[k].len - depth - 8);
+            }
+            radix_sort(ctx, e + i, j - i, depth + 8);
+        }
+        i = j;
+    }
+}
+
+static int dirlist_sort(DirListing *dl) {
+    if (dl->n < RADIX_MIN) {
+        insertion_sort(dl->names, dl->ents, dl->n, 0);
+        return 0;
+    }
+    SortCtx ctx;
+    ctx.names = dl->names;
+    ctx.tmp = malloc(dl->n * sizeof(RevealEnt));
+    ctx.count = malloc(8 * sizeof(*ctx.count));
+    if (!ctx.tmp || !ctx.count) {
+        free(ctx.tmp);
+        free(ctx.count);
+        errno = ENOMEM;
+        return -1;
+    }
+    radix_sort(&ctx, dl->ents, dl->n, 0);
+    free(ctx.tmp);
+    free(ctx.count);
+    return 0;
+}
+
+int dirlist_read(int fd, DirListing *dl) {
+#ifdef SYS_getdents64
+    char *buf = malloc(DENTS_BUF);
+    if (!buf) return -1;
+    while (1) {
+        long r = syscall(SYS_getdents64, fd, buf, DENTS_BUF);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            int e = errno;
+            free(buf);
+            errno = e;
+            return -1;
+        }
+        if (r == 0) break;
+        for (long off = 0; off < r;) {
+            struct dent64 *d = (struct dent64 *)(buf + off);
+            if (dirlist_add(dl, d->d_name, d->d_type) != 0) {
+                free(buf);
+                return -1;
+            }
+            off += d->d_reclen;
+        }
+    }
+    free(buf);
+#else
+    /* readdir on a duplicate, so the caller's fd stays open */
+    int dfd = dup(fd);
+    DIR *d = dfd >= 0 ? fdopendir(dfd) : NULL;
+    if (!d) {
+        if (dfd >= 0) close(dfd);
+        return -1;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (dirlist_add(dl, ent->d_name, DT_UNKNOWN) != 0) {
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
+#endif
+    return dirlist_sort(dl);
+}
+
+void dirlist_free(DirListing *dl) {
+    free(dl->names);
+    free(dl->ents);
+    memset(dl, 0, sizeof(*dl));
+}
+
+/* ----------- buffered output ----------- */
+
+/* Output either goes to fd in OUT_BUF blocks, or (fd < 0) collects in
+ * memory: one directory's part of a -R listing until its turn comes. */
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int fd;
+} OutBuf;
+
+static char out_mem[OUT_BUF];
+static OutBuf out_std = { out_mem, 0, OUT_BUF, STDOUT_FILENO };
+
+static void write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+static void out_flush(OutBuf *ob) {
+    if (ob->fd < 0) return;
+    write_all(ob->fd, ob->buf, ob->len);
+    ob->len = 0;
+}
+
+static void out_put(OutBuf *ob, const char *p, size_t n) {
+    if (ob->len + n > ob->cap) {
+        if (ob->fd >= 0) {
+            out_flush(ob);
+            if (n > ob->cap) {
+                write_all(ob->fd, p, n);
+                return;
+            }
+        } else {
+            size_t ncap = ob->cap ? ob->cap * 2 : 256;
+            while (ob->len + n > ncap) ncap *= 2;
+            char *t = realloc(ob->buf, ncap);
+            if (!t) return;
+            ob->buf = t;
+            ob->cap = ncap;
+        }
+    }
+    memcpy(ob->buf + ob->len, p, n);
+    ob->len += n;
+}
+
+/* Formatted output; anything longer than the stack buffer (a deep path)
+ * is formatted again into one of the right size */
+static void out_printf(OutBuf *ob, const char *fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(buf)) {
+        out_put(ob, buf, (size_t)n);
+        return;
+    }
+    char *big = malloc((size_t)n + 1);
+    if (!big) return;
+    va_start(ap, fmt);
+    vsnprintf(big, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    out_put(ob, big, (size_t)n);
+    free(big);
+}
+
+/* ----------- long format ----------- */
+
+/* What -L shows of one entry */
+typedef struct {
+    mode_t mode;
+    nlink_t nlink;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    time_t mtime;
+    int ok;
+} EntStat;
+
+static void stat_entry(int dirfd, const char *name, EntStat *st) {
+#ifdef STATX_BASIC_STATS
+    struct statx sx;
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW,
+              STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID |
+              STATX_SIZE | STATX_MTIME, &sx) == 0) {
+        st->mode = sx.stx_mode;
+        st->nlink = sx.stx_nlink;
+        st->uid = sx.stx_uid;
+        st->gid = sx.stx_gid;
+        st->size = (off_t)sx.stx_size;
+        st->mtime = sx.stx_mtime.tv_sec;
+        st->ok = 1;
+        return;
+    }
+    if (errno != ENOSYS) {
+        st->ok = 0;
+        return;
+    }
+#endif
+    struct stat sb;
+    if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+        st->ok = 0;
+        return;
+    }
+    st->mode = sb.st_mode;
+    st->nlink = sb.st_nlink;
+    st->uid = sb.st_uid;
+    st->gid = sb.st_gid;
+    st->size = sb.st_size;
+    st->mtime = sb.st_mtime;
+    st->ok = 1;
+}
+
+/* Entries idx[0..n) of dl, stat'ed into st[0..n) by several threads */
+typedef struct {
+    int dirfd;
+    const DirListing *dl;
+    const size_t *idx;
+    EntStat *st;
+    size_t n;
+    size_t next;
+    pthread_mutex_t lock;
+} StatWork;
+
+static void *stat_worker(void *arg) {
+    StatWork *w = arg;
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        size_t from = w->next;
+        w->next = from + STAT_CHUNK < w->n ? from + STAT_CHUNK : w->n;
+        size_t to = w->next;
+        pthread_mutex_unlock(&w->lock);
+        if (from >= to) break;
+        for (size_t i = from; i < to; ++i) {
+            stat_entry(w->dirfd, dirlist_name(w->dl, w->idx[i]), &w->st[i]);
+        }
+    }
+    return NULL;
+}
+
+/* Start nt threads running fn(arg) with every signal blocked, so signals
+ * stay with the main thread. Returns how many started. */
+static size_t start_threads(pthread_t *tids, size_t nt, void *(*fn)(void *), void *arg) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    size_t started = 0;
+    while (started < nt && pthread_create(&tids[started], NULL, fn, arg) == 0) started++;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return started;
+}
+
+/* With 'parallel', large directories are stat'ed by STAT_THREADS threads */
+static void stat_entries(int dirfd, const DirListing *dl, const size_t *idx, EntStat *st,
+                         size_t n, int parallel) {
+    StatWork w;
+    w.dirfd = dirfd;
+    w.dl = dl;
+    w.idx = idx;
+    w.st = st;
+    w.n = n;
+    w.next = 0;
+    if (parallel && n >= STAT_PARALLEL_MIN && pthread_mutex_init(&w.lock, NULL) == 0) {
+        pthread_t tids[STAT_THREADS - 1];
+        size_t nt = start_threads(tids, STAT_THREADS - 1, stat_worker, &w);
+        stat_worker(&w);
+        for (size_t i = 0; i < nt; ++i) pthread_join(tids[i], NULL);
+        pthread_mutex_destroy(&w.lock);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) stat_entry(dirfd, dirlist_name(dl, idx[i]), &st[i]);
+}
+
+static void mode_string(mode_t m, char out[11]) {
+    char t = '?';
+    if (S_ISREG(m)) t = '-';
+    else if (S_ISDIR(m)) t = 'd';
+    else if (S_ISLNK(m)) t = 'l';
+    else if (S_ISCHR(m)) t = 'c';
+    else if (S_ISBLK(m)) t = 'b';
+    else if (S_ISFIFO(m)) t = 'p';
+    else if (S_ISSOCK(m)) t = 's';
+    out[0] = t;
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; ++i) out[1 + i] = (m & (0400 >> i)) ? rwx[i] : '-';
+    if (m & S_ISUID) out[3] = (m & S_IXUSR) ? 's' : 'S';
+    if (m & S_ISGID) out[6] = (m & S_IXGRP) ? 's' : 'S';
+    if (m & S_ISVTX) out[9] = (m & S_IXOTH) ? 't' : 'T';
+    out[10] = '\0';
+}
+
+/* uid/gid -> name, remembered for the listing being printed */
+typedef struct {
+    unsigned id;
+    char name[32];
+} IdName;
+
+#define ID_CACHE 32
+
+static const char *id_name(IdName *cache, size_t *n, unsigned id, int group) {
+    for (size_t i = 0; i < *n; ++i) {
+        if (cache[i].id == id) return cache[i].name;
+    }
+    /* when full, the last slot is reused */
+    IdName *e = *n < ID_CACHE ? &cache[(*n)++] : &cache[ID_CACHE - 1];
+    e->id = id;
+    char buf[1024];
+    const char *nm = NULL;
+    if (group) {
+        struct group g, *gp = NULL;
+        if (getgrgid_r((gid_t)id, &g, buf, sizeof(buf), &gp) == 0 && gp) nm = gp->gr_name;
+    } else {
+        struct passwd pw, *pp = NULL;
+        if (getpwuid_r((uid_t)id, &pw, buf, sizeof(buf), &pp) == 0 && pp) nm = pp->pw_name;
+    }
+    if (nm) snprintf(e->name, sizeof(e->name), "%s", nm);
+    else snprintf(e->name, sizeof(e->name), "%u", id);
+    return e->name;
+}
+
+static void print_long(OutBuf *ob, int dirfd, const DirListing *dl, const size_t *idx,
+                       size_t n, int parallel) {
+    EntStat *st = malloc((n ? n : 1) * sizeof(EntStat));
+    if (!st) return;
+    stat_entries(dirfd, dl, idx, st, n, parallel);
+
+    IdName users[ID_CACHE], groups[ID_CACHE];
+    size_t nusers = 0, ngroups = 0;
+    int wlink = 1, wuser = 1, wgroup = 1, wsize = 1;
+    char num[32];
+    for (size_t i = 0; i < n; ++i) {
+        if (!st[i].ok) continue;
+        int l = snprintf(num, sizeof(num), "%lu", (unsigned long)st[i].nlink);
+        if (l > wlink) wlink = l;
+        l = snprintf(num, sizeof(num), "%lld", (long long)st[i].size);
+        if (l > wsize) wsize = l;
+        l = (int)strlen(id_name(users, &nusers, (unsigned)st[i].uid, 0));
+        if (l > wuser) wuser = l;
+        l = (int)strlen(id_name(groups, &ngroups, (unsigned)st[i].gid, 1));
+        if (l > wgroup) wgroup = l;
+    }
+
+    time_t now = time(NULL);
+    for (size_t i = 0; i < n; ++i) {
+        const char *name = dirlist_name(dl, idx[i]);
+        if (!st[i].ok) {
+            out_printf(ob, "?????????? %*s %-*s %-*s %*s %12s %s\n", wlink, "?", wuser, "?",
+                       wgroup, "?", wsize, "?", "?", name);
+            continue;
+        }
+        char mode[11];
+        mode_string(st[i].mode, mode);
+        char when[32];
+        struct tm tm;
+        localtime_r(&st[i].mtime, &tm);
+        /* older than six months or in the future: show the year */
+        if (st[i].mtime > now || now - st[i].mtime > 15778476) {
+            strftime(when, sizeof(when), "%b %e  %Y", &tm);
+        } else {
+            strftime(when, sizeof(when), "%b %e %H:%M", &tm);
+        }
+        out_printf(ob, "%s %*lu %-*s %-*s %*lld %s %s", mode, wlink, (unsigned long)st[i].nlink,
+                   wuser, id_name(users, &nusers, (unsigned)st[i].uid, 0),
+                   wgroup, id_name(groups, &ngroups, (unsigned)st[i].gid, 1),
+                   wsize, (long long)st[i].size, when, name);
+        if (S_ISLNK(st[i].mode)) {
+            char target[PATH_MAX];
+            ssize_t tl = readlinkat(dirfd, name, target, sizeof(target));
+            if (tl > 0) {
+                out_put(ob, " -> ", 4);
+                out_put(ob, target, (size_t)tl);
+            }
+        }
+        out_put(ob, "\n", 1);
+    }
+    free(st);
+}
+
+/* One directory's listing in the format 'flags' asks for */
+static void format_listing(OutBuf *ob, int dirfd, const DirListing *dl, int flags,
+                           int parallel) {
+    if (flags & REVEAL_LONG) {
+        size_t *idx = malloc((dl->n ? dl->n : 1) * sizeof(size_t));
+        if (!idx) return;
+        size_t n = 0;
+        for (size_t i = 0; i < dl->n; ++i) {
+            if ((flags & REVEAL_ALL) || dirlist_name(dl, i)[0] != '.') idx[n++] = i;
+        }
+        if (n == 0) out_put(ob, "\n", 1);
+        else print_long(ob, dirfd, dl, idx, n, parallel);
+        free(idx);
+        return;
+    }
+    int lines = flags & REVEAL_LINES;
+    char sep = lines ? '\n' : ' ';
+    size_t shown = 0;
+    for (size_t i = 0; i < dl->n; ++i) {
+        const char *name = dirlist_name(dl, i);
+        if (!(flags & REVEAL_ALL) && name[0] == '.') continue;
+        if (shown++ && !lines) out_put(ob, &sep, 1);
+        out_put(ob, name, dl->ents[i].len);
+        if (lines) out_put(ob, &sep, 1);
+    }
+    if (shown == 0 || !lines) out_put(ob, "\n", 1);
+}
+
+/* ----------- recursive walk (-R, -s) ----------- */
+
+/* One directory of the tree. Workers fill it in; the main thread prints it
+ * once done, in sorted preorder (or postorder with sizes). */
+typedef struct WalkNode {
+    char *path;
+    int fd;                      /* opened by the parent's worker, or -1 */
+    int done;
+    OutBuf out;                  /* header and listing */
+    struct WalkNode **children;  /* subdirectories, sorted */
+    size_t nchildren;
+    unsigned long long bytes;    /* sizes of its files (-s), then of its subtree */
+    unsigned long long files;
+} WalkNode;
+
+/* Work-stealing deque: the owner pushes and pops at the bottom, thieves
+ * take from the top, where the oldest (shallowest) directories are. */
+typedef struct {
+    WalkNode **items;
+    size_t head, tail, cap;
+    pthread_mutex_t lock;
+} Deque;
+
+typedef struct {
+    int flags;
+    Deque *deques;
+    size_t nthreads;
+    pthread_mutex_t lock;        /* guards everything below and node->done */
+    pthread_cond_t work_cv;      /* new work, or everything is done */
+    pthread_cond_t done_cv;      /* a node is done (main thread waits) */
+    size_t pending;              /* nodes not yet processed */
+    size_t idle;
+    unsigned long gen;           /* bumped on every push */
+    size_t open_fds;             /* fds held by queued nodes */
+} Walk;
+
+typedef struct {
+    Walk *w;
+    size_t self;
+} WalkArg;
+
+static int deque_push(Deque *d, WalkNode *n) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        /* slide down over what thieves took, or grow */
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(WalkNode *));
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            size_t ncap = d->cap ? d->cap * 2 : 64;
+            WalkNode **t = realloc(d->items, ncap * sizeof(WalkNode *));
+            if (!t) {
+                pthread_mutex_unlock(&d->lock);
+                return -1;
+            }
+            d->items = t;
+            d->cap = ncap;
+        }
+    }
+    d->items[d->tail++] = n;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+static WalkNode *deque_pop(Deque *d) {
+    WalkNode *n = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) n = d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+static WalkNode *deque_steal(Deque *d) {
+    WalkNode *n = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) n = d->items[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+static WalkNode *walk_node_new(const char *parent, const char *name, size_t nlen) {
+    WalkNode *n = calloc(1, sizeof(WalkNode));
+    if (!n) return NULL;
+    size_t plen = strlen(parent);
+    int slash = plen > 0 && parent[plen - 1] != '/';
+    n->path = malloc(plen + slash + nlen + 1);
+    if (!n->path) {
+        free(n);
+        return NULL;
+    }
+    memcpy(n->path, parent, plen);
+    if (slash) n->path[plen] = '/';
+    memcpy(n->path + plen + slash, name, nlen);
+    n->path[plen + slash + nlen] = '\0';
+    n->fd = -1;
+    n->out.fd = -1;
+    return n;
+}
+
+static void walk_node_free(WalkNode *n) {
+    if (n->fd >= 0) close(n->fd);
+    free(n->path);
+    free(n->out.buf);
+    free(n->children);
+    free(n);
+}
+
+/* Whether entry i of dl (open as dirfd) is a directory to descend into */
+static int is_subdir(int dirfd, const DirListing *dl, size_t i) {
+    unsigned char t = dl->ents[i].type;
+    if (t == DT_DIR) return 1;
+    if (t != DT_UNKNOWN) return 0;
+    struct stat sb;
+    return fstatat(dirfd, dirlist_name(dl, i), &sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+           S_ISDIR(sb.st_mode);
+}
+
+/* Read one directory: its listing or file sizes, and its subdirectories
+ * as new nodes (which the caller queues) */
+static void walk_process(Walk *w, WalkNode *node) {
+    int sizes = w->flags & REVEAL_SIZES;
+    int fd = node->fd;
+    node->fd = -1;
+    if (fd >= 0) {
+        pthread_mutex_lock(&w->lock);
+        w->open_fds--;
+        pthread_mutex_unlock(&w->lock);
+    } else {
+        fd = open(node->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (!sizes) out_printf(&node->out, "%s:\n", node->path);
+    DirListing dl;
+    memset(&dl, 0, sizeof(dl));
+    if (fd < 0 || dirlist_read(fd, &dl) != 0) {
+        if (!sizes) out_printf(&node->out, "No such directory!\n");
+        if (fd >= 0) close(fd);
+        dirlist_free(&dl);
+        return;
+    }
+    if (!sizes) format_listing(&node->out, fd, &dl, w->flags, 0);
+
+    size_t nsub = 0;
+    for (size_t i = 0; i < dl.n; ++i) {
+        const char *name = dirlist_name(&dl, i);
+        if (!(w->flags & REVEAL_ALL) && name[0] == '.') continue;
+        if (is_subdir(fd, &dl, i)) {
+            /* gather subdirectories at the front, still in order */
+            RevealEnt t = dl.ents[nsub];
+            dl.ents[nsub++] = dl.ents[i];
+            dl.ents[i] = t;
+        } else if (sizes) {
+            EntStat st;
+            stat_entry(fd, name, &st);
+            if (st.ok) {
+                node->bytes += (unsigned long long)st.size;
+                node->files++;
+            }
+        }
+    }
+    if (nsub > 0) node->children = malloc(nsub * sizeof(WalkNode *));
+    if (node->children) {
+        for (size_t i = 0; i < nsub; ++i) {
+            WalkNode *c = walk_node_new(node->path, dirlist_name(&dl, i), dl.ents[i].len);
+            if (!c) break;
+            /* hand the child an open fd while the budget lasts */
+            pthread_mutex_lock(&w->lock);
+            int take = w->open_fds < WALK_FDS;
+            if (take) w->open_fds++;
+            pthread_mutex_unlock(&w->lock);
+            if (take) {
+                c->fd = openat(fd, dirlist_name(&dl, i),
+                               O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (c->fd < 0) {
+                    pthread_mutex_lock(&w->lock);
+                    w->open_fds--;
+                    pthread_mutex_unlock(&w->lock);
+                }
+            }
+            node->children[node->nchildren++] = c;
+        }
+    }
+    close(fd);
+    dirlist_free(&dl);
+}
+
+static WalkNode *walk_find_work(Walk *w, size_t self) {
+    WalkNode *n = deque_pop(&w->deques[self]);
+    for (size_t k = 1; !n && k < w->nthreads; ++k) {
+        n = deque_steal(&w->deques[(self + k) % w->nthreads]);
+    }
+    return n;
+}
+
+static void *walk_worker(void *arg) {
+    WalkArg *a = arg;
+    Walk *w = a->w;
+    size_t self = a->self;
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        unsigned long gen = w->gen;
+        pthread_mutex_unlock(&w->lock);
+
+        WalkNode *node = walk_find_work(w, self);
+        if (!node) {
+            pthread_mutex_lock(&w->lock);
+            if (w->pending == 0) {
+                pthread_mutex_unlock(&w->lock);
+                break;
+            }
+            /* nothing to steal yet: sleep unless something was pushed meanwhile */
+            if (w->gen == gen) {
+                w->idle++;
+                pthread_cond_wait(&w->work_cv, &w->lock);
+                w->idle--;
+            }
+            pthread_mutex_unlock(&w->lock);
+            continue;
+        }
+
+        walk_process(w, node);
+        /* counted before they are visible, so a thief finishing one cannot
+         * bring pending to 0 early */
+        pthread_mutex_lock(&w->lock);
+        w->pending += node->nchildren;
+        pthread_mutex_unlock(&w->lock);
+        /* children go on our own deque in reverse, so the first pops first */
+        size_t failed = 0;
+        for (size_t i = node->nchildren; i-- > 0;) {
+            if (deque_push(&w->deques[self], node->children[i]) != 0) {
+                WalkNode *c = node->children[i];
+                if (c->fd >= 0) {
+                    close(c->fd);
+                    c->fd = -1;
+                    pthread_mutex_lock(&w->lock);
+                    w->open_fds--;
+                    pthread_mutex_unlock(&w->lock);
+                }
+                c->done = 1;   /* shown without a header */
+                failed++;
+            }
+        }
+        pthread_mutex_lock(&w->lock);
+        node->done = 1;
+        w->pending -= 1 + failed;
+        w->gen++;
+        if (w->idle > 0 || w->pending == 0) pthread_cond_broadcast(&w->work_cv);
+        pthread_cond_broadcast(&w->done_cv);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+static void walk_wait(Walk *w, WalkNode *n) {
+    pthread_mutex_lock(&w->lock);
+    while (!n->done) pthread_cond_wait(&w->done_cv, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void walk_tree_free(WalkNode *n) {
+    for (size_t i = 0; i < n->nchildren; ++i) walk_tree_free(n->children[i]);
+    walk_node_free(n);
+}
+
+/* Print the listing in preorder as nodes complete, freeing them as we go */
+static int walk_emit_listing(Walk *w, WalkNode *root) {
+    size_t cap = 64, top = 0;
+    WalkNode **stack = malloc(cap * sizeof(WalkNode *));
+    if (!stack) return -1;
+    stack[top++] = root;
+    int first = 1;
+    while (top > 0) {
+        WalkNode *n = stack[top - 1];
+        walk_wait(w, n);
+        if (top - 1 + n->nchildren > cap) {
+            size_t ncap = cap;
+            while (top - 1 + n->nchildren > ncap) ncap *= 2;
+            WalkNode **t = realloc(stack, ncap * sizeof(WalkNode *));
+            if (!t) {
+                /* let the walk finish, then drop what is left */
+                pthread_mutex_lock(&w->lock);
+                while (w->pending > 0) pthread_cond_wait(&w->done_cv, &w->lock);
+                pthread_mutex_unlock(&w->lock);
+                while (top > 0) walk_tree_free(stack[--top]);
+                free(stack);
+                return -1;
+            }
+            stack = t;
+            cap = ncap;
+        }
+        --top;
+        if (!first) out_put(&out_std, "\n", 1);
+        first = 0;
+        out_put(&out_std, n->out.buf, n->out.len);
+        for (size_t i = n->nchildren; i-- > 0;) stack[top++] = n->children[i];
+        walk_node_free(n);
+    }
+    free(stack);
+    return 0;
+}
+
+/* -s: subtree sizes, children before parents (the walk is over) */
+static void walk_emit_sizes(WalkNode *n) {
+    for (size_t i = 0; i < n->nchildren; ++i) {
+        WalkNode *c = n->children[i];
+        walk_emit_sizes(c);
+        n->bytes += c->bytes;
+        n->files += c->files;
+        walk_node_free(c);
+    }
+    out_printf(&out_std, "%llu\t%llu\t%s\n", n->bytes, n->files, n->path);
+}
+
+static int reveal_walk(const char *dirpath, int flags) {
+    int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("No such directory!\n");
+        return -1;
+    }
+    Walk w;
+    memset(&w, 0, sizeof(w));
+    w.flags = flags;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    w.nthreads = ncpu < 2 ? 2 : (size_t)ncpu;
+    if (w.nthreads > WALK_THREADS_MAX) w.nthreads = WALK_THREADS_MAX;
+    w.deques = calloc(w.nthreads, sizeof(Deque));
+    WalkArg *args = calloc(w.nthreads, sizeof(WalkArg));
+    pthread_t *tids = calloc(w.nthreads, sizeof(pthread_t));
+    WalkNode *root = walk_node_new("", dirpath, strlen(dirpath));
+    if (!w.deques || !args || !tids || !root) {
+        free(w.deques);
+        free(args);
+        free(tids);
+        if (root) walk_node_free(root);
+        close(fd);
+        return -1;
+    }
+    root->fd = fd;
+    w.open_fds = 1;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.work_cv, NULL);
+    pthread_cond_init(&w.done_cv, NULL);
+    for (size_t i = 0; i < w.nthreads; ++i) {
+        pthread_mutex_init(&w.deques[i].lock, NULL);
+        args[i].w = &w;
+        args[i].self = i;
+    }
+    deque_push(&w.deques[0], root);
+    w.pending = 1;
+
+    /* whatever stdio holds must come first */
+    fflush(stdout);
+    int ret = 1;
+    size_t nt = 0;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    while (nt < w.nthreads && pthread_create(&tids[nt], NULL, walk_worker, &args[nt]) == 0) nt++;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (nt == 0) {
+        /* no threads: walk on this one */
+        w.nthreads = 1;
+        walk_worker(&args[0]);
+    }
+
+    if (flags & REVEAL_SIZES) {
+        for (size_t i = 0; i < nt; ++i) pthread_join(tids[i], NULL);
+        walk_emit_sizes(root);
+        walk_node_free(root);
+    } else {
+        if (walk_emit_listing(&w, root) != 0) ret = -1;
+        for (size_t i = 0; i < nt; ++i) pthread_join(tids[i], NULL);
+    }
+    out_flush(&out_std);
+
+    for (size_t i = 0; i < w.nthreads; ++i) {
+        pthread_mutex_destroy(&w.deques[i].lock);
+        free(w.deques[i].items);
+    }
+    pthread_cond_destroy(&w.done_cv);
+    pthread_cond_destroy(&w.work_cv);
+    pthread_mutex_destroy(&w.lock);
+    free(w.deques);
+    free(args);
+    free(tids);
+    return ret;
+}
+
+int reveal_list(const char *dirpath, int flags) {
+    if (flags & (REVEAL_RECURSIVE | REVEAL_SIZES)) return reveal_walk(dirpath, flags);
+    int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("No such directory!\n");
+        return -1;
+    }
+    const DirListing *dl = dircache_listing(fd, dirpath);
+    if (!dl) {
+        int e = errno;
+        close(fd);
+        if (e != ENOMEM) printf("No such directory!\n");
+        return -1;
+    }
+
+    /* whatever stdio holds must come first */
+    fflush(stdout);
+    format_listing(&out_std, fd, dl, flags, 1);
+    out_flush(&out_std);
+    close(fd);
+    return 1;
+}
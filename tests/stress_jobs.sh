@@ -0,0 +1,40 @@
+#!/bin/sh
+# Job table stress test: start N background jobs from one shell, list them
+# with activities, let them finish and check that every one was reaped and
+# reported and that the table ends up empty.
+#
+#   tests/stress_jobs.sh [N]        (default 10000; run from the repo root)
+
+N=${1:-10000}
+# long enough for every job to still be running when activities lists them
+SECS=$((N / 1000 + 3))
+SHELL_BIN=${SHELL_BIN:-$(pwd)/shell.out}
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+[ -x "$SHELL_BIN" ] || { echo "stress_jobs: build $SHELL_BIN first" >&2; exit 1; }
+
+# The shell keeps its history next to where it starts, so run it in $DIR
+cd "$DIR" || exit 1
+{
+    i=0
+    while [ "$i" -lt "$N" ]; do
+        echo "sleep $SECS &"
+        i=$((i + 1))
+    done
+    echo "activities"
+    echo "sleep $((SECS + 1))"
+    echo "echo ==== after"
+    echo "activities"
+} > input
+
+start=$(date +%s)
+"$SHELL_BIN" < input > output 2>&1
+end=$(date +%s)
+
+listed=$(sed -n '/==== after/q;p' output | grep -c " : sleep $SECS - Running")
+reported=$(grep -c 'exited normally' output)
+left=$(sed -n '/==== after/,$p' output | grep -c ' - Running\| - Stopped')
+
+echo "jobs: $N  listed: $listed  reported: $reported  left: $left  time: $((end - start))s"
+[ "$listed" -eq "$N" ] && [ "$reported" -eq "$N" ] && [ "$left" -eq 0 ]